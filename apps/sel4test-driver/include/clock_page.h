@@ -0,0 +1,114 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+/* this file is shared between sel4test-driver and sel4test-tests */
+#pragma once
+
+#include <autoconf.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <utils/time.h>
+#ifdef CONFIG_ARCH_X86
+#include <platsupport/arch/tsc.h>
+#endif
+
+/* With CONFIG_CLOCK_PAGE the driver maps this page read-only into each test
+ * process, so tests can turn a counter they can read at user level into the
+ * driver's time without asking the driver. The time at count is
+ *
+ *   base_ns + (count - base_count) / freq seconds
+ *
+ * The driver moves the base now and then. seq is odd while it does, and changes
+ * every time, so a reader that sees the same even seq before and after reading
+ * the page got a consistent copy. */
+typedef struct clock_page {
+    uint32_t seq;
+    /* counter ticks per second, 0 if there is no counter to read. The seq
+     * check makes reading these safe even where a 64 bit access isn't atomic. */
+    volatile uint64_t freq;
+    volatile uint64_t base_count;
+    volatile uint64_t base_ns;
+} clock_page_t;
+
+/* Whether there is a counter that can be read at user level */
+#if defined(CONFIG_ARCH_X86) || (defined(CONFIG_ARCH_AARCH64) && \
+                                 (defined(CONFIG_EXPORT_PCNT_USER) || defined(CONFIG_EXPORT_VCNT_USER)))
+#define CLOCK_COUNTER_AVAILABLE 1
+#else
+#define CLOCK_COUNTER_AVAILABLE 0
+#endif
+
+static inline uint64_t clock_counter(void)
+{
+#if defined(CONFIG_ARCH_X86)
+    return rdtsc_pure();
+#elif defined(CONFIG_ARCH_AARCH64) && defined(CONFIG_EXPORT_PCNT_USER)
+    uint64_t ticks;
+    asm volatile("isb; mrs %0, cntpct_el0" : "=r"(ticks));
+    return ticks;
+#elif defined(CONFIG_ARCH_AARCH64) && defined(CONFIG_EXPORT_VCNT_USER)
+    uint64_t ticks;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return 0;
+#endif
+}
+
+/* Ticks per second of clock_counter where the hardware says what it is, or 0
+ * if it has to be measured, as the TSC's does, or there is no counter */
+static inline uint64_t clock_counter_freq(void)
+{
+#if defined(CONFIG_ARCH_AARCH64) && CLOCK_COUNTER_AVAILABLE
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return freq;
+#else
+    return 0;
+#endif
+}
+
+static inline uint64_t clock_ticks_to_ns(uint64_t ticks, uint64_t freq)
+{
+    /* split the conversion so it doesn't overflow */
+    return (ticks / freq) * NS_IN_S + ((ticks % freq) * NS_IN_S) / freq;
+}
+
+/* Read the time from the page. Returns false if there is no counter. */
+static inline bool clock_page_read(const clock_page_t *page, uint64_t *ns)
+{
+    uint32_t seq;
+    uint64_t freq, base_count, base_ns, count;
+    do {
+        seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        freq = page->freq;
+        base_count = page->base_count;
+        base_ns = page->base_ns;
+        count = clock_counter();
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&page->seq, __ATOMIC_RELAXED));
+
+    if (freq == 0) {
+        return false;
+    }
+    /* another core's counter may be a little behind the one the base came from */
+    uint64_t ticks = count > base_count ? count - base_count : 0;
+    *ns = base_ns + clock_ticks_to_ns(ticks, freq);
+    return true;
+}
+
+/* Move the base of the page to base_ns at base_count. Only the driver writes
+ * to the page. */
+static inline void clock_page_set(clock_page_t *page, uint64_t freq, uint64_t base_count, uint64_t base_ns)
+{
+    uint32_t seq = page->seq;
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    page->freq = freq;
+    page->base_count = base_count;
+    page->base_ns = base_ns;
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+/* this file is shared between sel4test-driver and sel4test-tests */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <utils/util.h>
+
+/* A buffer that keeps the last bytes of output written to it. It is used to
+ * hold the output of a test until it is known whether the test failed, and with
+ * CONFIG_LOG_RING to pass the output of a test process to the driver without
+ * any system calls.
+ *
+ * When a ring is shared, the test process is the only one that writes to it and
+ * the driver drains it. Either may take bytes out of the ring, by moving tail
+ * forward. Only the test process moves head, and only once the bytes are in
+ * the ring. */
+#define LOG_RING_SIZE PAGE_SIZE_4K
+typedef struct log_ring {
+    /* number of bytes ever written to and taken out of the ring. These wrap
+     * around, which is fine as LOG_RING_SIZE is a power of 2. */
+    uint32_t head;
+    uint32_t tail;
+    char buf[LOG_RING_SIZE];
+} log_ring_t;
+#define LOG_RING_PAGES (ROUND_UP(sizeof(log_ring_t), PAGE_SIZE_4K) / PAGE_SIZE_4K)
+
+static inline void log_ring_reset(log_ring_t *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+/* Take the count bytes at the tail of the ring out, if nobody else took them first */
+static inline bool log_ring_take(log_ring_t *ring, uint32_t tail, uint32_t count)
+{
+    return __atomic_compare_exchange_n(&ring->tail, &tail, tail + count, false, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE);
+}
+
+/* Copy count bytes from the ring, starting at byte pos, to dest */
+static inline void log_ring_copy(log_ring_t *ring, char *dest, uint32_t pos, uint32_t count)
+{
+    uint32_t offset = pos % LOG_RING_SIZE;
+    uint32_t first = MIN(count, LOG_RING_SIZE - offset);
+    memcpy(dest, ring->buf + offset, first);
+    memcpy(dest + first, ring->buf, count - first);
+}
+
+/* Add output to the ring. If there isn't room for it, the oldest bytes in the
+ * ring are passed to write to make room, or dropped if write is NULL. */
+static inline void log_ring_write(log_ring_t *ring, const char *data, size_t count,
+                                  size_t (*write)(void *data, size_t count))
+{
+    if (count > LOG_RING_SIZE && write == NULL) {
+        /* only the end of a write bigger than the ring survives */
+        data += count - LOG_RING_SIZE;
+        count = LOG_RING_SIZE;
+    }
+    while (count > 0) {
+        uint32_t head = ring->head;
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        uint32_t space = LOG_RING_SIZE - (head - tail);
+        if (space == 0 || (write == NULL && space < count)) {
+            /* Nobody else writes to the ring, so the bytes stay put once taken
+             * and can be written straight from the ring. */
+            uint32_t used = head - tail;
+            uint32_t n = write ? used : MIN(used, count - space);
+            if (log_ring_take(ring, tail, n) && write) {
+                uint32_t offset = tail % LOG_RING_SIZE;
+                uint32_t first = MIN(n, LOG_RING_SIZE - offset);
+                write(ring->buf + offset, first);
+                write(ring->buf, n - first);
+            }
+            continue;
+        }
+        uint32_t n = MIN(count, space);
+        uint32_t offset = head % LOG_RING_SIZE;
+        uint32_t first = MIN(n, LOG_RING_SIZE - offset);
+        memcpy(ring->buf + offset, data, first);
+        memcpy(ring->buf, data + first, n - first);
+        __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+        data += n;
+        count -= n;
+    }
+}
+
+/* Pass everything in a ring that the test process may still be writing to
+ * to write. The bytes are copied to scratch, which must hold LOG_RING_SIZE
+ * bytes, before they are taken out of the ring, as the test process can reuse
+ * the space as soon as they are. */
+static inline void log_ring_drain(log_ring_t *ring, char *scratch, size_t (*write)(void *data, size_t count))
+{
+    while (1) {
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            return;
+        }
+        if (head - tail > LOG_RING_SIZE) {
+            /* the test process took some bytes after we read tail */
+            continue;
+        }
+        log_ring_copy(ring, scratch, tail, head - tail);
+        if (log_ring_take(ring, tail, head - tail)) {
+            write(scratch, head - tail);
+        }
+    }
+}
+
+/* Pass what is left in a ring that nobody else is using to write, oldest first,
+ * and empty the ring. Returns the number of bytes that were dropped to make room
+ * for newer ones. */
+static inline uint32_t log_ring_replay(log_ring_t *ring, size_t (*write)(void *data, size_t count))
+{
+    uint32_t lost = ring->tail;
+    uint32_t offset = ring->tail % LOG_RING_SIZE;
+    uint32_t count = ring->head - ring->tail;
+    uint32_t first = MIN(count, LOG_RING_SIZE - offset);
+    write(ring->buf + offset, first);
+    write(ring->buf, count - first);
+    log_ring_reset(ring);
+    return lost;
+}
@@ -5,13 +5,95 @@
  */
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <sel4/sel4.h>
 #include <sel4test/test.h>
 #include <sel4utils/elf.h>
+#include <utils/util.h>
 
 #define TEST_PROCESS_CSPACE_SIZE_BITS 17
+
+/* With CONFIG_TWO_LEVEL_CSPACE the cspace of a test process is a small root
+ * CNode. Its first slot holds a CNode with the caps from the driver, and the test
+ * process adds more second level CNodes to it as it runs out of slots. */
+#define TEST_PROCESS_CSPACE_L1_BITS 6
+#define TEST_PROCESS_CSPACE_L2_BITS 12
+/* Slot of the root CNode that holds the CNode of untypeds when
+ * CONFIG_SHARED_UNTYPED_CNODE is set */
+#define TEST_PROCESS_UNTYPED_CNODE_INDEX 1
+
+/* Test type for tests that leave nothing behind except objects made from the
+ * untypeds they were given. With CONFIG_REUSE_TEST_PROCESS these tests run one
+ * after another in the same process. */
+#define STATELESS (BASIC + 1)
+#define DEFINE_TEST_STATELESS(_name, _description, _function, _enabled) \
+    DEFINE_TEST_WITH_TYPE(_name, _description, _function, STATELESS, _enabled)
+
+/* Optional description of the resources a test in sel4test-tests needs. The
+ * driver reads these from the _test_metadata section of the tests image, so they
+ * can't contain pointers. Every field may be left as 0. */
+#define TEST_TAGS_MAX 48
+/* The driver reads the section as an array, so every entry must be the same
+ * size as its alignment, or the compiler may leave gaps between them. */
+#define TEST_METADATA_SIZE 128
+typedef struct test_metadata {
+    /* name of the test this describes */
+    char name[TEST_NAME_MAX];
+    /* expected run time in microseconds */
+    uint64_t runtime_us;
+    /* most untyped memory the test process uses, including its own set up */
+    uint64_t untyped_bytes;
+    /* number of cores the test runs threads on */
+    uint32_t cores;
+    /* whether the test uses the timer */
+    bool needs_timer;
+    /* whether the test must have the machine to itself */
+    bool exclusive;
+    /* whether the test uses device_frame_cap */
+    bool needs_device_frame;
+    /* space separated tags the test can be selected by */
+    char tags[TEST_TAGS_MAX];
+} ALIGN(TEST_METADATA_SIZE) test_metadata_t;
+compile_time_assert(test_metadata_size, sizeof(test_metadata_t) == TEST_METADATA_SIZE);
+
+#define DEFINE_TEST_METADATA(_name, ...) \
+    static USED SECTION("_test_metadata") test_metadata_t TEST_METADATA_ ## _name = { \
+        .name = #_name, __VA_ARGS__ \
+    };
+
+/* Whether the output of tests is only printed when they fail, see
+ * CONFIG_QUIET_OUTPUT. XML output is never quiet, so that every test appears in
+ * the results. */
+#define QUIET_OUTPUT (config_set(CONFIG_QUIET_OUTPUT) && !config_set(CONFIG_PRINT_XML))
+
+/* Untyped memory the allocator of a test process has handed out for the current
+ * test, kept up to date by the test process when CONFIG_MEMORY_ACCOUNTING is set.
+ * Memory allocman takes for its own bookkeeping isn't counted. */
+typedef struct test_memory {
+    /* bytes of untyped memory in use now, and the most that has been in use */
+    uint64_t bytes;
+    uint64_t peak_bytes;
+    /* number of objects of each type allocated */
+    uint32_t objects[seL4_ObjectTypeCount];
+} test_memory_t;
+
+/* Number of timer clients a test process has. Each client has its own timeout in
+ * the driver and its own notification, which the driver signals with badge
+ * TIMER_CLIENT_BADGE(client), so several threads can use the timer at once.
+ * Client 0 is signalled on timer_ntfn.
+ *
+ * A time request names its client in the word after its other arguments. A
+ * reset for TIMER_ALL_CLIENTS resets every client. */
+#define TIMER_CLIENTS 8
+#define TIMER_ALL_CLIENTS TIMER_CLIENTS
+#define TIMER_CLIENT_BADGE(client) BIT(client)
+
+/* A test process reports its result in MR 0. A process that can run another
+ * test sends this in MR 1 and waits for a reply once the driver has cleaned up
+ * after the test and written the name of the next test to the init data. */
+#define TEST_PROCESS_WAITING 1
 /* Init data shared between sel4test-driver and the sel4test-tests app -- the
  * sel4test-driver creates a shmem page to be shared between the driver and the
  * test child processes, and uses this struct to pass the data in the shmem
@@ -45,6 +127,8 @@ typedef struct {
      * and expecting a signal and/or notification.
      */
     seL4_CPtr timer_ntfn;
+    /* notifications of each timer client, the first of which is timer_ntfn */
+    seL4_CPtr timer_client_ntfns[TIMER_CLIENTS];
 
     /* size of the test processes cspace */
     seL4_Word cspace_size_bits;
@@ -56,6 +140,10 @@ typedef struct {
     /* size of untyped that each untyped cap corresponds to
      * (size of the cap at untypeds.start is untyped_size_bits_lits[0]) */
     uint8_t untyped_size_bits_list[CONFIG_MAX_NUM_BOOTINFO_UNTYPED_CAPS];
+    /* number of untypeds, from the start of the untypeds range, that the test
+     * process has handed to its allocator. Written by the test process before it
+     * uses each untyped, so the driver only needs to revoke these. */
+    seL4_Word untypeds_used;
     /* name of the test to run */
     char name[TEST_NAME_MAX];
     /* priority the test process is running at */
@@ -72,6 +160,17 @@ typedef struct {
     /* device frame cap */
     seL4_CPtr device_frame_cap;
 
+    /* ring the test process writes its output to, NULL unless CONFIG_LOG_RING
+     * is set. It is a log_ring_t, which the driver drains. */
+    void *log_ring;
+
+    /* read-only clock page of the driver, NULL unless CONFIG_CLOCK_PAGE is set.
+     * It is a clock_page_t. */
+    void *clock_page;
+
+    /* untyped memory used by the current test, written by the test process */
+    test_memory_t memory;
+
     /* List of elf regions in the test process image, this
      * is provided so the test process can launch copies of itself.
      *
@@ -89,7 +188,7 @@ typedef struct {
     /* address of the stack */
     void *stack;
 
-    /* freq of the tsc (for x86) */
+    /* freq of the tsc in MHz (for x86) */
     uint32_t tsc_freq;
 
     /* number of available cores */
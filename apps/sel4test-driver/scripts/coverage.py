@@ -14,6 +14,8 @@
 # coverage.py staging/arm/imx31/kernel.elf /tmp/qemu.log --functions --objdump | less -R
 #
 
+from __future__ import print_function
+
 import sys
 import os
 import re
@@ -60,40 +62,15 @@ def get_tool(toolname):
     return os.environ.get('TOOLPREFIX', default_prefix) + toolname
 
 
-def main():
-    parser = argparse.ArgumentParser(
-        description='Generate coverage information of a binary.')
-    parser.add_argument('kernel_elf_filename', metavar='<kernel ELF>',
-                        type=str, help='The kernel ELF file used for the log.')
-    parser.add_argument('coverage_filename', metavar='<qemu log>',
-                        type=str, help='The qemu logfile containing the instruction trace.')
-    parser.add_argument('--functions', action='store_true',
-                        help='Produce a summary of the functions covered.')
-    parser.add_argument('--objdump', action='store_true',
-                        help='Produce an objdump with coverage information.')
-    parser.add_argument('--no-color', action='store_true', default=False,
-                        help='Produce coloured output.')
-
-    args = parser.parse_args()
-    colors = Colors(not args.no_color)
-
-    # We will need to run objdump on the ELF file.
-    kernel_elf_filename = args.kernel_elf_filename
-
-    # This is the raw qemu.log file.
-    coverage_filename = args.coverage_filename
-
-    # Run objdump on the kernel binary.
+def parse_objdump(elf_filename):
+    """Disassemble an ELF file and return its lines, the address of each line
+    (None if it isn't an instruction), a map from function name to the set of
+    instruction addresses in it, and the address of arm_vector_table, if any."""
     objdump_proc = Popen([get_tool('objdump'), '-d', '-j', '.text',
-                          kernel_elf_filename], stdout=PIPE)
+                          elf_filename], stdout=PIPE, universal_newlines=True)
     objdump_lines = objdump_proc.stdout.readlines()
 
-    seL4_arm_vector_table_address = None
-
-    # Now, parse the objdump file and retain the following data:
-
-    # A map from address to line number within the objdump file.
-    addr2lineno = {}
+    vector_table_address = None
 
     # Can be seen as a map from line number in objdump file -> address.
     objdump_addreses = []
@@ -103,17 +80,16 @@ def main():
     function_instructions = {}
 
     current_function = None
-    line_re = re.compile(r'^([0-9a-f]+):')
+    line_re = re.compile(r'^\s*([0-9a-f]+):')
     ignore_re = re.compile(r'\.word|\.short|\.byte|undefined instruction')
     function_name_re = re.compile(r'^([0-9a-f]+) <([^>]+)>')
-    for i, line in enumerate(objdump_lines):
+    for line in objdump_lines:
         addr = None
         g = line_re.match(line)
         if g:
             g2 = ignore_re.search(line)
             if not g2:
                 addr = int(g.group(1), 16)
-                addr2lineno[addr] = i
 
         objdump_addreses.append(addr)
 
@@ -126,51 +102,84 @@ def main():
             function_instructions[current_function] = set()
 
             if current_function == 'arm_vector_table':
-                seL4_arm_vector_table_address = int(g.group(1), 16)
+                vector_table_address = int(g.group(1), 16)
 
-    try:
-        coverage_file = open(coverage_filename, 'r')
-    except:
-        print >>sys.stderr, 'Failed to open %s' % coverage_filename
-        return -1
+    return objdump_lines, objdump_addreses, function_instructions, vector_table_address
 
-    # Record all executable instructions in the ELF file into a set.
-    covered_instructions = set()
-    trace_entry = re.compile(r'^Trace 0x[0-f]+ \[([0-f]+)\]')
-    for line in coverage_file.readlines():
-        entry = re.search(trace_entry, line)
+
+# Older versions of qemu log "Trace 0x... [pc]", newer ones log
+# "Trace 0: 0x... [asid/pc/flags...]".
+trace_entry = re.compile(r'^Trace (?:\d+: )?0x[0-9a-f]+ \[(?:[0-9a-f]+/)?([0-9a-f]+)[/\]]')
+
+
+def trace_addresses(lines, vector_table_address=None):
+    """Yield the address of each instruction executed in a qemu exec log."""
+    for line in lines:
+        entry = trace_entry.search(line)
         if not entry:
             continue
         addr = int(entry.group(1), 16)
-        if addr in addr2lineno:
-            covered_instructions.add(addr)
 
         # Sigh. And of course, here are some seL4-specific hacks. The vectors page
         # is not at the correct address in the binary. It is mapped at 0xffff0000
         # in memory, but starts at arm_vector_table in the binary. Account for that
         # here.
-        if 0xffff0000 <= addr <= 0xffff1000 and seL4_arm_vector_table_address is not None:
-            covered_instructions.add(addr - 0xffff0000 + seL4_arm_vector_table_address)
+        if 0xffff0000 <= addr <= 0xffff1000 and vector_table_address is not None:
+            addr = addr - 0xffff0000 + vector_table_address
+        yield addr
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Generate coverage information of a binary.')
+    parser.add_argument('kernel_elf_filename', metavar='<kernel ELF>',
+                        type=str, help='The kernel ELF file used for the log.')
+    parser.add_argument('coverage_filename', metavar='<qemu log>',
+                        type=str, help='The qemu logfile containing the instruction trace.')
+    parser.add_argument('--functions', action='store_true',
+                        help='Produce a summary of the functions covered.')
+    parser.add_argument('--objdump', action='store_true',
+                        help='Produce an objdump with coverage information.')
+    parser.add_argument('--no-color', action='store_true', default=False,
+                        help='Produce coloured output.')
+
+    args = parser.parse_args()
+    colors = Colors(not args.no_color)
+
+    # Run objdump on the kernel binary.
+    objdump_lines, objdump_addreses, function_instructions, vector_table_address = \
+        parse_objdump(args.kernel_elf_filename)
+    instructions = set(a for a in objdump_addreses if a is not None)
+
+    try:
+        coverage_file = open(args.coverage_filename, 'r')
+    except IOError:
+        sys.stderr.write('Failed to open %s\n' % args.coverage_filename)
+        return -1
+
+    # Record all executable instructions in the ELF file into a set.
+    covered_instructions = set(trace_addresses(coverage_file, vector_table_address))
+    covered_instructions &= instructions
     coverage_file.close()
 
     # Print basic information.
     num_covered = len(covered_instructions)
-    num_total = len(addr2lineno)
-    print '%d/%d instructions covered (%.1f%%)' % (
+    num_total = len(instructions)
+    print('%d/%d instructions covered (%.1f%%)' % (
         num_covered, num_total,
-        100.0 * num_covered / num_total)
+        100.0 * num_covered / num_total))
 
     if args.functions:
         # For each function, calculate how many instructions were covered.
         function_coverage = {}
-        for f, instructions in function_instructions.iteritems():
+        for f, instructions in function_instructions.items():
             num_instructions = len(instructions)
             if num_instructions > 0:
                 covered = len(instructions.intersection(covered_instructions))
                 function_coverage[f] = (covered, num_instructions)
 
         # Sort by coverage and print.
-        for f, x in sorted(function_coverage.items(), key=lambda (f, x): 1.0 * x[0] / x[1]):
+        for f, x in sorted(function_coverage.items(), key=lambda fx: 1.0 * fx[1][0] / fx[1][1]):
             pct = 100.0 * x[0] / x[1]
 
             if pct == 0.0:
@@ -188,7 +197,7 @@ def main():
         for i, line in enumerate(objdump_lines):
             addr = objdump_addreses[i]
             covered = addr in covered_instructions
-            valid = addr in addr2lineno
+            valid = addr is not None
             if covered:
                 colour = colors.DARK_GREEN
             elif valid:
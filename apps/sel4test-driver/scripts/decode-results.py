@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+#
+# Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+#
+# Decode the records that sel4test-driver prints with Sel4testBinaryResults
+# set, see src/results.h for their format.
+#
+# Usage:
+# ./decode-results.py sel4test-output.log --junit results.xml --csv results.csv --samples samples.csv
+#
+# Any other output of a test, such as the reason it failed, is kept in the JUnit
+# XML. Records that fail their CRC are skipped with a warning.
+#
+
+import argparse
+import base64
+import binascii
+import csv
+import sys
+from xml.sax.saxutils import escape, quoteattr
+
+RESULT_MARKER = b'@@'
+
+RESULT_SUITE_START = 1
+RESULT_TEST_START = 2
+RESULT_TEST_END = 3
+RESULT_SUITE_END = 4
+RESULT_SAMPLE = 5
+
+RESULTS = {0: 'SUCCESS', 1: 'FAILURE', 2: 'ABORT', 3: 'TIMEOUT'}
+UNITS = {1: 'ns', 2: 'cycles'}
+PHASES = ['set_up', 'run', 'tear_down']
+
+
+class Record(object):
+    def __init__(self, data):
+        self.type = data[0]
+        self.data = data[1:]
+        self.pos = 0
+
+    def byte(self):
+        value = self.data[self.pos]
+        self.pos += 1
+        return value
+
+    def number(self):
+        value = 0
+        shift = 0
+        while True:
+            byte = self.byte()
+            value |= (byte & 0x7f) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value
+
+    def string(self):
+        value = self.data[self.pos:].decode('utf-8', 'replace')
+        self.pos = len(self.data)
+        return value
+
+
+def decode_line(line):
+    """The record on a line, None if there isn't one, or False if it is corrupt"""
+    start = line.find(RESULT_MARKER)
+    if start < 0:
+        return None
+    encoded = line[start + len(RESULT_MARKER):].strip()
+    try:
+        data = base64.b64decode(encoded + b'=' * (-len(encoded) % 4), validate=True)
+    except binascii.Error:
+        return False
+    if len(data) < 5 or binascii.crc32(data[:-4]) != int.from_bytes(data[-4:], 'little'):
+        return False
+    return Record(data[:-4])
+
+
+def decode(log):
+    tests = []
+    samples = []
+    suite = None
+    current = None
+    corrupt = 0
+
+    for line in log:
+        record = decode_line(line)
+        if record is None:
+            if current is not None:
+                current['output'].append(line.decode('utf-8', 'replace').rstrip('\r\n'))
+            continue
+        if record is False:
+            corrupt += 1
+            continue
+
+        if record.type == RESULT_TEST_START:
+            number = record.number()
+            current = {'number': number, 'name': record.string(), 'output': [],
+                       'result': None, 'units': None, 'times': []}
+            tests.append(current)
+        elif record.type == RESULT_TEST_END and current is not None:
+            current['result'] = RESULTS.get(record.byte(), 'UNKNOWN')
+            units = record.byte()
+            if units:
+                current['units'] = UNITS.get(units, 'unknown')
+                current['times'] = [record.number() for _ in PHASES]
+            current = None
+        elif record.type == RESULT_SUITE_END:
+            suite = (record.number(), record.number(), record.number())
+        elif record.type == RESULT_SAMPLE:
+            value = record.number()
+            samples.append((current['name'] if current else '', record.string(), value))
+
+    if corrupt:
+        sys.stderr.write('Skipped %d corrupt records\n' % corrupt)
+    return tests, samples, suite
+
+
+def write_junit(f, tests):
+    failures = sum(1 for t in tests if t['result'] != 'SUCCESS')
+    f.write('<testsuite name="sel4test" tests="%d" failures="%d">\n' % (len(tests), failures))
+    for test in tests:
+        attrs = 'classname="sel4test" name=%s' % quoteattr(test['name'])
+        if test['units'] == 'ns':
+            attrs += ' time="%.9f"' % (sum(test['times']) / 1e9)
+        f.write('\t<testcase %s>\n' % attrs)
+        if test['result'] is None:
+            f.write('\t\t<error type="INCOMPLETE">Test did not finish</error>\n')
+        elif test['result'] != 'SUCCESS':
+            f.write('\t\t<failure type=%s/>\n' % quoteattr(test['result']))
+        if test['output']:
+            f.write('\t\t<system-out>%s</system-out>\n' % escape('\n'.join(test['output'])))
+        f.write('\t</testcase>\n')
+    f.write('</testsuite>\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode the binary results of sel4test.')
+    parser.add_argument('log', metavar='<log>', help='Output of sel4test.')
+    parser.add_argument('--junit', metavar='<file>', help='Write the results as JUnit XML.')
+    parser.add_argument('--csv', metavar='<file>', help='Write the result and times of each test as CSV.')
+    parser.add_argument('--samples', metavar='<file>', help='Write the samples taken by tests as CSV.')
+    args = parser.parse_args()
+
+    with open(args.log, 'rb') as log:
+        tests, samples, suite = decode(log)
+
+    if args.junit:
+        with open(args.junit, 'w') as f:
+            write_junit(f, tests)
+    if args.csv:
+        with open(args.csv, 'w') as f:
+            writer = csv.writer(f)
+            writer.writerow(['number', 'name', 'result', 'units'] + PHASES)
+            for test in tests:
+                writer.writerow([test['number'], test['name'], test['result'], test['units'] or ''] + test['times'])
+    if args.samples:
+        with open(args.samples, 'w') as f:
+            writer = csv.writer(f)
+            writer.writerow(['test', 'name', 'value'])
+            writer.writerows(samples)
+
+    passed = sum(1 for t in tests if t['result'] == 'SUCCESS')
+    print('%d/%d tests passed' % (passed, len(tests)))
+    if suite is None:
+        print('The test suite did not finish')
+        return 1
+    return 0 if passed == len(tests) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
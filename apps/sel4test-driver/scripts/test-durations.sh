@@ -0,0 +1,20 @@
+#!/bin/sh
+#
+# Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+# Extract the duration of each test from the output of sel4test-driver, in a
+# form that can be given to the Sel4testShardDurations build option.
+#
+# Usage:
+# ./test-durations.sh sel4test-output.log > durations.txt
+#
+# Each output line is a test name and its total time in microseconds.
+
+exec cat "$@" | sed -e 's/\cM//' | awk '
+/^Test [^ ]+ took set_up [0-9.]+ us, run [0-9.]+ us, tear_down [0-9.]+ us$/ {
+    gsub(",", "")
+    printf "%s %d\n", $2, $5 + $8 + $11 + 0.5
+}'
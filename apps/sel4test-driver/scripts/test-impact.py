@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+#
+# Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+#
+# Work out which tests exercise which kernel functions, and which tests need to
+# run after a change to some kernel functions.
+#
+# To build the map, run sel4test in qemu with "-singlestep -d exec -D qemu.log"
+# and the serial output saved to a separate file, without
+# Sel4testParallelTests and with Sel4testRepeatCount set to 1. Then:
+#
+# test-impact.py map kernel.elf sel4test-driver qemu.log serial.log > coverage-map.txt
+#
+# The map has a line for each test with the test's name followed by the kernel
+# functions it ran. Keep it with the build it came from, and regenerate it when
+# tests are added. To get the tests affected by a change:
+#
+# test-impact.py select coverage-map.txt changed_function_a changed_function_b
+#
+# This prints a regex for LibSel4TestPrinterRegex. With --cmake it instead
+# writes a file that can be passed to cmake with -C. If no tests run the
+# changed functions it prints "no tests affected" and writes no file, as
+# sel4test fails when no tests are selected.
+#
+
+import argparse
+import re
+import sys
+
+from coverage import parse_objdump, trace_addresses
+
+# The driver calls these at the start and end of every test
+START_FUNCTION = 'sel4test_start_test'
+END_FUNCTION = 'sel4test_end_test'
+
+
+def function_entry(function_instructions, name, elf_filename):
+    if not function_instructions.get(name):
+        sys.exit('%s not found in %s' % (name, elf_filename))
+    return min(function_instructions[name])
+
+
+def test_names(serial_filename):
+    """The names of the tests in the order the driver started them"""
+    start_re = re.compile(r'^Starting test \d+: (.*?)\r?$|<testcase classname="[^"]*" name="([^"]*)">')
+    names = []
+    with open(serial_filename, 'r', errors='replace') as serial:
+        for line in serial:
+            m = start_re.search(line)
+            if m:
+                names.append(m.group(1) or m.group(2))
+    return names
+
+
+def build_map(args):
+    _, _, function_instructions, vector_table_address = parse_objdump(args.kernel_elf)
+    function_of = {}
+    for function, instructions in function_instructions.items():
+        for addr in instructions:
+            function_of[addr] = function
+
+    _, _, driver_functions, _ = parse_objdump(args.driver_elf)
+    start = function_entry(driver_functions, START_FUNCTION, args.driver_elf)
+    end = function_entry(driver_functions, END_FUNCTION, args.driver_elf)
+    names = test_names(args.serial_log)
+
+    # Kernel functions run between the driver starting and ending each test.
+    # The trace doesn't say which address space an instruction ran in, so a
+    # test process can hit one of the driver's addresses. Only a start that
+    # follows an end, or an end that follows a start, counts.
+    coverage = []
+    current = None
+    with open(args.qemu_log, 'r', errors='replace') as log:
+        for addr in trace_addresses(log, vector_table_address):
+            if addr == start and current is None:
+                current = set()
+            elif addr == end and current is not None:
+                coverage.append(current)
+                current = None
+            elif current is not None and addr in function_of:
+                current.add(function_of[addr])
+
+    if len(coverage) != len(names):
+        sys.exit('Found %d tests in %s but %d in %s' %
+                 (len(coverage), args.qemu_log, len(names), args.serial_log))
+
+    # The driver's own checks, such as "Test all tests ran", have spaces in
+    # their names and always run, so they are left out.
+    merged = {}
+    for name, functions in zip(names, coverage):
+        if ' ' not in name:
+            merged.setdefault(name, set()).update(functions)
+    for name in sorted(merged):
+        print(' '.join([name] + sorted(merged[name])))
+    return 0
+
+
+def read_map(map_filename):
+    tests = {}
+    with open(map_filename, 'r') as f:
+        for line in f:
+            fields = line.split()
+            if fields and not fields[0].startswith('#'):
+                tests[fields[0]] = set(fields[1:])
+    return tests
+
+
+def select_tests(args):
+    tests = read_map(args.map)
+    changed = set(args.functions)
+    if args.changed_file:
+        with open(args.changed_file, 'r') as f:
+            changed.update(f.read().split())
+
+    selected = sorted(name for name, functions in tests.items() if functions & changed)
+    if not selected:
+        # a regex that matches nothing would fail the check that there are tests
+        print('no tests affected')
+        return 0
+    regex = '^(%s)$' % '|'.join(selected)
+
+    if args.cmake:
+        with open(args.cmake, 'w') as f:
+            f.write('# %d of %d tests run the changed kernel functions\n' % (len(selected), len(tests)))
+            f.write('set(LibSel4TestPrinterRegex "%s" CACHE STRING "" FORCE)\n' % regex)
+            if args.shards:
+                f.write('set(Sel4testShardCount "%d" CACHE STRING "" FORCE)\n' % args.shards)
+    else:
+        print(regex)
+    sys.stderr.write('%d of %d tests run the changed kernel functions\n' % (len(selected), len(tests)))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Select the tests that run changed kernel functions.')
+    subparsers = parser.add_subparsers(dest='command')
+    subparsers.required = True
+
+    map_parser = subparsers.add_parser('map', help='Map each test to the kernel functions it runs.')
+    map_parser.add_argument('kernel_elf', metavar='<kernel ELF>',
+                            help='The kernel ELF file used for the log.')
+    map_parser.add_argument('driver_elf', metavar='<sel4test-driver ELF>',
+                            help='The sel4test-driver ELF file used for the log.')
+    map_parser.add_argument('qemu_log', metavar='<qemu log>',
+                            help='The qemu logfile containing the instruction trace.')
+    map_parser.add_argument('serial_log', metavar='<serial log>',
+                            help='The output of sel4test from the same run.')
+    map_parser.set_defaults(func=build_map)
+
+    select_parser = subparsers.add_parser('select', help='Select the tests that run any of the given functions.')
+    select_parser.add_argument('map', metavar='<coverage map>',
+                               help='Output of the map command.')
+    select_parser.add_argument('functions', metavar='<function>', nargs='*',
+                               help='Kernel functions that changed.')
+    select_parser.add_argument('--changed-file', metavar='<file>',
+                               help='File with more changed kernel functions, separated by white space.')
+    select_parser.add_argument('--cmake', metavar='<file>',
+                               help='Write a cmake initial cache file instead of printing the regex.')
+    select_parser.add_argument('--shards', type=int, default=0,
+                               help='Also set Sel4testShardCount in the cmake file.')
+    select_parser.set_defaults(func=select_tests)
+
+    args = parser.parse_args()
+    return args.func(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
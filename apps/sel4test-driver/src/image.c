@@ -0,0 +1,158 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Include Kconfig variables. */
+#include <autoconf.h>
+#include <sel4test-driver/gen_config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <cpio/cpio.h>
+#include <elf/elf.h>
+#include <sel4utils/elf.h>
+#include <sel4utils/process.h>
+#include <sel4utils/vspace.h>
+#include <utils/util.h>
+#include <vspace/vspace.h>
+
+#include "image.h"
+
+void image_find_all(driver_env_t env, void *archive, unsigned long len)
+{
+    const char *name;
+    unsigned long size;
+    const void *file;
+    for (int i = 0; (file = cpio_get_entry(archive, len, i, &name, &size)) != NULL; i++) {
+        /* the images are named after the sel4test-tests app, with the suite as a suffix */
+        if (strncmp(name, TESTS_APP, strlen(TESTS_APP)) != 0) {
+            continue;
+        }
+        ZF_LOGF_IF(env->num_images == MAX_TEST_IMAGES, "Too many "TESTS_APP" images");
+        test_image_t *image = &env->images[env->num_images];
+        image->name = name;
+        int error = elf_newFile(file, size, &image->elf);
+        ZF_LOGF_IF(error, "Error: invalid ELF file %s", name);
+
+        uint64_t section_size = 0;
+        image->tests = (testcase_t *) sel4utils_elf_get_section(&image->elf, "_test_case", &section_size);
+        ZF_LOGF_IF(image->tests == NULL, "%s: Failed to find section: _test_case", name);
+        image->num_tests = section_size / sizeof(testcase_t);
+
+        /* tests don't have to describe themselves, so the metadata section may not exist */
+        image->metadata = (test_metadata_t *) sel4utils_elf_get_section(&image->elf, "_test_metadata", &section_size);
+        image->num_metadata = image->metadata != NULL ? section_size / sizeof(test_metadata_t) : 0;
+
+        /* parse elf region data about the test image to pass to the tests app */
+        image->num_elf_regions = sel4utils_elf_num_regions(&image->elf);
+        ZF_LOGF_IF(image->num_elf_regions > MAX_REGIONS, "Too many regions in %s", name);
+        sel4utils_elf_reserve(NULL, &image->elf, image->elf_regions);
+
+        env->num_images++;
+    }
+    ZF_LOGF_IF(env->num_images == 0, "Error: failed to lookup "TESTS_APP" ELF file");
+}
+
+test_image_t *image_of_test(driver_env_t env, testcase_t *test)
+{
+    for (int i = 0; i < env->num_images; i++) {
+        test_image_t *image = &env->images[i];
+        if (test >= image->tests && test < image->tests + image->num_tests) {
+            return image;
+        }
+    }
+    return NULL;
+}
+
+void image_init(driver_env_t env, test_image_t *image)
+{
+    elf_t *elf = &image->elf;
+
+    image->num_regions = sel4utils_elf_num_regions(elf);
+    ZF_LOGF_IF(image->num_regions > MAX_REGIONS, "Too many regions in %s", image->name);
+    sel4utils_elf_reserve(NULL, elf, image->regions);
+
+    /* regions are created in the same order as the PT_LOAD headers they came from */
+    int num_headers = elf_getNumProgramHeaders(elf);
+    for (int i = 0, region = 0; i < num_headers; i++) {
+        if (elf_getProgramHeaderType(elf, i) != PT_LOAD) {
+            continue;
+        }
+
+        /* new frames are zeroed, so only the initialised part of the segment needs to be copied */
+        size_t num_pages = BYTES_TO_4K_PAGES(image->regions[region].size);
+        image->contents[region] = vspace_new_pages(&env->vspace, seL4_AllRights, num_pages, PAGE_BITS_4K);
+        ZF_LOGF_IF(image->contents[region] == NULL, "Failed to allocate %zu pages for image region", num_pages);
+
+        uintptr_t offset = elf_getProgramHeaderVaddr(elf, i) - (uintptr_t) image->regions[region].elf_vstart;
+        const char *source = (const char *) elf->elfFile + elf_getProgramHeaderOffset(elf, i);
+        memcpy((char *) image->contents[region] + offset, source, elf_getProgramHeaderFileSize(elf, i));
+        region++;
+    }
+
+    image->entry_point = (void *) elf_getEntryPoint(elf);
+    image->sysinfo = sel4utils_elf_get_vsyscall(elf);
+
+    image->num_phdrs = sel4utils_elf_num_phdrs(elf);
+    image->phdrs = calloc(image->num_phdrs, sizeof(Elf_Phdr));
+    ZF_LOGF_IF(image->phdrs == NULL, "Failed to allocate program headers");
+    sel4utils_elf_read_phdrs(elf, image->num_phdrs, image->phdrs);
+}
+
+sel4utils_process_config_t image_process_config(test_image_t *image, sel4utils_elf_region_t *regions,
+                                                sel4utils_process_config_t config)
+{
+    config = process_config_noelf(config, image->entry_point, image->sysinfo);
+    /* Reserve the image regions before the stack and ipc buffer get placed.
+     * Creating the vspace fills in the reservations, so each process needs
+     * its own copy of the regions. */
+    memcpy(regions, image->regions, image->num_regions * sizeof(*regions));
+    return process_config_create_vspace(config, regions, image->num_regions);
+}
+
+void image_load(driver_env_t env, test_image_t *image, sel4utils_elf_region_t *regions,
+                sel4utils_process_t *process)
+{
+    int error;
+
+    for (int i = 0; i < image->num_regions; i++) {
+        sel4utils_elf_region_t *region = &regions[i];
+        size_t num_pages = BYTES_TO_4K_PAGES(region->size);
+
+        if (!seL4_CapRights_get_capAllowWrite(region->rights)) {
+            /* read only regions are never modified, so every test process can map the same frames.
+             * The mappings carry no cookie, so tearing down the process only deletes the cap copies. */
+            error = sel4utils_share_mem_at_vaddr(&env->vspace, &process->vspace, image->contents[i], num_pages,
+                                                 PAGE_BITS_4K, region->elf_vstart, region->reservation);
+            ZF_LOGF_IF(error, "Failed to share read only image region %d", i);
+            continue;
+        }
+
+        /* writable regions get fresh frames owned by the process, initialised from the template */
+        error = vspace_new_pages_at_vaddr(&process->vspace, region->elf_vstart, num_pages, PAGE_BITS_4K,
+                                          region->reservation);
+        ZF_LOGF_IF(error, "Failed to allocate writable image region %d", i);
+
+        void *vaddr = vspace_share_mem(&process->vspace, &env->vspace, region->elf_vstart, num_pages, PAGE_BITS_4K,
+                                       seL4_AllRights, 1);
+        ZF_LOGF_IF(vaddr == NULL, "Failed to map writable image region %d into the driver", i);
+        memcpy(vaddr, image->contents[i], region->size);
+        vspace_unmap_pages(&env->vspace, vaddr, num_pages, PAGE_BITS_4K, &env->vka);
+    }
+
+    /* the process frees its program headers when it is destroyed, so give it its own copy */
+    process->elf_phdrs = calloc(image->num_phdrs, sizeof(Elf_Phdr));
+    ZF_LOGF_IF(process->elf_phdrs == NULL, "Failed to allocate program headers");
+    memcpy(process->elf_phdrs, image->phdrs, image->num_phdrs * sizeof(Elf_Phdr));
+    process->num_elf_phdrs = image->num_phdrs;
+}
+
+void image_unload(test_image_t *image, sel4utils_elf_region_t *regions, sel4utils_process_t *process)
+{
+    for (int i = 0; i < image->num_regions; i++) {
+        vspace_free_reservation(&process->vspace, regions[i].reservation);
+    }
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+#include <sel4utils/process.h>
+#include <sel4utils/elf.h>
+#include "test.h"
+
+/* Functions for managing the sel4test-tests images */
+
+/* Find every sel4test-tests image in a CPIO archive and the tests in each */
+void image_find_all(driver_env_t env, void *archive, unsigned long len);
+/* Image that a test in sel4test-tests is in, NULL if it is a driver test */
+test_image_t *image_of_test(driver_env_t env, testcase_t *test);
+
+/* Functions for preloaded images (CONFIG_PROCESS_TEMPLATE) */
+
+/* Load every region of a tests image into the driver's vspace */
+void image_init(driver_env_t env, test_image_t *image);
+/* Adjust a process config so the process is created without loading the image.
+ * regions holds the process' reservations of the image regions, and must have
+ * room for all of them and last as long as the process. */
+sel4utils_process_config_t image_process_config(test_image_t *image, sel4utils_elf_region_t *regions,
+                                                sel4utils_process_config_t config);
+/* Map an image into a process created with image_process_config */
+void image_load(driver_env_t env, test_image_t *image, sel4utils_elf_region_t *regions,
+                sel4utils_process_t *process);
+/* Release the image reservations of a process before it is destroyed */
+void image_unload(test_image_t *image, sel4utils_elf_region_t *regions, sel4utils_process_t *process);
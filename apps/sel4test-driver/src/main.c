@@ -16,6 +16,7 @@
 #include <limits.h>
 
 #include <sel4runtime.h>
+#include <arch_stdio.h>
 
 #include <allocman/bootstrap.h>
 #include <allocman/vka.h>
@@ -45,6 +46,9 @@
 #include <vspace/vspace.h>
 #include "test.h"
 #include "timer.h"
+#include "image.h"
+#include "results.h"
+#include "test_durations.h"
 
 #include <sel4platsupport/io.h>
 
@@ -74,7 +78,42 @@ static uint8_t untyped_size_bits_list[CONFIG_MAX_NUM_BOOTINFO_UNTYPED_CAPS];
 extern char _cpio_archive[];
 extern char _cpio_archive_end[];
 
-static elf_t tests_elf;
+/* phases of setting up the driver, timed when CONFIG_BOOT_PROFILE is set */
+#define MAX_BOOT_PHASES 16
+struct boot_phase {
+    const char *name;
+    uint64_t end;
+};
+static struct boot_phase boot_phases[MAX_BOOT_PHASES];
+static int num_boot_phases;
+static uint64_t boot_start;
+
+static void boot_phase_done(const char *name)
+{
+    if (config_set(CONFIG_BOOT_PROFILE) && num_boot_phases < MAX_BOOT_PHASES) {
+        boot_phases[num_boot_phases] = (struct boot_phase) {
+            .name = name,
+            .end = boot_timestamp(),
+        };
+        num_boot_phases++;
+    }
+}
+
+static void print_boot_phases(void)
+{
+    const char *units = boot_timestamp_units();
+    if (!config_set(CONFIG_BOOT_PROFILE) || units == NULL || num_boot_phases == 0) {
+        return;
+    }
+
+    printf("Boot phases:\n");
+    uint64_t start = boot_start;
+    for (int i = 0; i < num_boot_phases; i++) {
+        printf("\t%s: %llu %s\n", boot_phases[i].name, (unsigned long long)(boot_phases[i].end - start), units);
+        start = boot_phases[i].end;
+    }
+    printf("\tTotal before the first test: %llu %s\n", (unsigned long long)(start - boot_start), units);
+}
 
 /* initialise our runtime environment */
 static void init_env(driver_env_t env)
@@ -125,6 +164,24 @@ static void free_objects(vka_object_t *objects, unsigned int num)
     }
 }
 
+/* Size of the largest untyped of normal memory in bootinfo. The allocator
+ * can't hand out an untyped any bigger than this. */
+static uint8_t max_untyped_size_bits(void)
+{
+    uint8_t max = PAGE_BITS_4K;
+    int untyped_count = simple_get_untyped_count(&env.simple);
+    for (int i = 0; i < untyped_count; i++) {
+        bool device = false;
+        uintptr_t ut_paddr = 0;
+        size_t ut_size_bits = 0;
+        simple_get_nth_untyped(&env.simple, i, &ut_size_bits, &ut_paddr, &device);
+        if (!device && ut_size_bits > max) {
+            max = ut_size_bits;
+        }
+    }
+    return MIN(max, seL4_WordBits - 1);
+}
+
 /* Allocate untypeds till either a certain number of bytes is allocated
  * or a certain number of untyped objects */
 static unsigned int allocate_untypeds(vka_object_t *untypeds, size_t bytes, unsigned int max_untypeds)
@@ -132,8 +189,9 @@ static unsigned int allocate_untypeds(vka_object_t *untypeds, size_t bytes, unsi
     unsigned int num_untypeds = 0;
     size_t allocated = 0;
 
-    /* try to allocate as many of each possible untyped size as possible */
-    for (uint8_t size_bits = seL4_WordBits - 1; size_bits > PAGE_BITS_4K; size_bits--) {
+    /* try to allocate as many of each possible untyped size as possible,
+     * starting from the biggest size that could possibly succeed */
+    for (uint8_t size_bits = max_untyped_size_bits(); size_bits > PAGE_BITS_4K; size_bits--) {
         /* keep allocating until we run out, or if allocating would
          * cause us to allocate too much memory*/
         while (num_untypeds < max_untypeds &&
@@ -171,6 +229,28 @@ static unsigned int populate_untypeds(vka_object_t *untypeds)
     return num_untypeds;
 }
 
+/* allocate a piece of device untyped memory for the frame tests */
+static void alloc_device_frame(void)
+{
+    bool allocated = false;
+    int untyped_count = simple_get_untyped_count(&env.simple);
+    for (int i = 0; i < untyped_count; i++) {
+        bool device = false;
+        uintptr_t ut_paddr = 0;
+        size_t ut_size_bits = 0;
+        simple_get_nth_untyped(&env.simple, i, &ut_size_bits, &ut_paddr, &device);
+        if (device) {
+            int error = vka_alloc_frame_at(&env.vka, seL4_PageBits, ut_paddr, &env.device_obj);
+            if (!error) {
+                allocated = true;
+                /* we've allocated a single device frame and that's all we need */
+                break;
+            }
+        }
+    }
+    ZF_LOGF_IF(allocated == false, "Failed to allocate a device frame for the frame tests");
+}
+
 static void init_timer(void)
 {
     if (config_set(CONFIG_HAVE_TIMER)) {
@@ -183,51 +263,452 @@ static void init_timer(void)
         error = vka_alloc_notification(&env.vka, &env.timer_notify_test);
         ZF_LOGF_IF(error, "Failed to allocate notification object for tests");
 
+        /* each timer client of a test gets its own notification, signalled
+         * with a badge saying which client it is */
+        for (int i = 0; i < TIMER_CLIENTS; i++) {
+            if (i == 0) {
+                env.timer_client_ntfns[i] = env.timer_notify_test;
+            } else {
+                error = vka_alloc_notification(&env.vka, &env.timer_client_ntfns[i]);
+                ZF_LOGF_IF(error, "Failed to allocate notification object for timer client %d", i);
+            }
+            cspacepath_t src;
+            vka_cspace_make_path(&env.vka, env.timer_client_ntfns[i].cptr, &src);
+            error = vka_cspace_alloc_path(&env.vka, &env.timer_client_signals[i]);
+            ZF_LOGF_IF(error, "Failed to allocate slot for badged timer client notification");
+            error = vka_cnode_mint(&env.timer_client_signals[i], &src, seL4_AllRights, TIMER_CLIENT_BADGE(i));
+            ZF_LOGF_IF(error, "Failed to mint badged timer client notification");
+        }
+
         error = seL4_TCB_BindNotification(simple_get_tcb(&env.simple), env.timer_notification.cptr);
         ZF_LOGF_IF(error, "Failed to bind timer notification to sel4test-driver\n");
 
         /* set up the timer manager */
-        tm_init(&env.tm, &env.ltimer, &env.ops, 1);
+        tm_init(&env.tm, &env.ltimer, &env.ops, NUM_TIMER_IDS);
+        timer_wheel_setup(&env);
     }
 }
 
 void sel4test_start_suite(const char *name)
 {
-    if (config_set(CONFIG_PRINT_XML)) {
+    if (config_set(CONFIG_BINARY_RESULTS)) {
+        result_suite_start();
+    } else if (config_set(CONFIG_PRINT_XML)) {
         printf("<testsuite>\n");
     } else {
         printf("Starting test suite %s\n", name);
     }
 }
 
+/* name of the test currently being reported */
+static const char *current_test_name;
+
+/* the slowest tests so far, slowest first */
+struct slow_test {
+    const char *name;
+    uint64_t total;
+    test_times_t times;
+};
+static struct slow_test slowest_tests[CONFIG_SLOWEST_TESTS > 0 ? CONFIG_SLOWEST_TESTS : 1];
+static int num_slowest_tests;
+/* time spent in each phase over all tests */
+static test_times_t total_times;
+
+static const char *test_phase_names[NUM_TEST_PHASES] = {
+    [TEST_PHASE_SET_UP] = "set_up",
+    [TEST_PHASE_RUN] = "run",
+    [TEST_PHASE_TEAR_DOWN] = "tear_down",
+};
+
+/* Print a test time in us, or in cycles if there is no timer */
+static void print_test_time(uint64_t time)
+{
+    if (strcmp(test_timestamp_units(), "ns") == 0) {
+        printf("%llu.%03llu us", (unsigned long long)(time / NS_IN_US), (unsigned long long)(time % NS_IN_US));
+    } else {
+        printf("%llu cycles", (unsigned long long) time);
+    }
+}
+
+static void record_test_times(const char *name, const test_times_t *times)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_TEST_PHASES; i++) {
+        total += times->phase[i];
+        total_times.phase[i] += times->phase[i];
+    }
+
+    /* insert the test into the slowest list, dropping the fastest if it is full */
+    int i = num_slowest_tests;
+    if (i == CONFIG_SLOWEST_TESTS) {
+        if (i == 0 || slowest_tests[i - 1].total >= total) {
+            return;
+        }
+        i--;
+    } else {
+        num_slowest_tests++;
+    }
+    for (; i > 0 && slowest_tests[i - 1].total < total; i--) {
+        slowest_tests[i] = slowest_tests[i - 1];
+    }
+    slowest_tests[i] = (struct slow_test) {
+        .name = name,
+        .total = total,
+        .times = *times,
+    };
+}
+
+static void print_slowest_tests(void)
+{
+    if (num_slowest_tests == 0 || test_timestamp_units() == NULL) {
+        return;
+    }
+
+    printf("Time spent in each phase:");
+    for (int i = 0; i < NUM_TEST_PHASES; i++) {
+        printf(" %s ", test_phase_names[i]);
+        print_test_time(total_times.phase[i]);
+    }
+    printf("\n");
+
+    printf("%d slowest tests:\n", num_slowest_tests);
+    for (int i = 0; i < num_slowest_tests; i++) {
+        printf("\t%s: ", slowest_tests[i].name);
+        print_test_time(slowest_tests[i].total);
+        printf(" (");
+        for (int j = 0; j < NUM_TEST_PHASES; j++) {
+            printf("%s%s ", j ? ", " : "", test_phase_names[j]);
+            print_test_time(slowest_tests[i].times.phase[j]);
+        }
+        printf(")\n");
+    }
+}
+
+/* results of running each test CONFIG_REPEAT_COUNT times */
+struct repeat_stats {
+    const char *name;
+    int runs;
+    int passes;
+    uint64_t min;
+    uint64_t median;
+    uint64_t p99;
+    uint64_t max;
+};
+static struct repeat_stats *repeat_stats;
+static int num_repeat_stats;
+
+static int time_comparator(const void *a, const void *b)
+{
+    uint64_t ta = *(const uint64_t *) a;
+    uint64_t tb = *(const uint64_t *) b;
+    return (ta > tb) - (ta < tb);
+}
+
+/* Record the results of the repeated runs of a test. times is sorted in place. */
+static void record_repeat_stats(const char *name, int passes, uint64_t *times, int runs)
+{
+    if (repeat_stats == NULL || runs == 0) {
+        return;
+    }
+
+    qsort(times, runs, sizeof(uint64_t), time_comparator);
+    repeat_stats[num_repeat_stats] = (struct repeat_stats) {
+        .name = name,
+        .runs = runs,
+        .passes = passes,
+        .min = times[0],
+        .median = times[(runs - 1) / 2],
+        /* nearest rank */
+        .p99 = times[DIV_ROUND_UP(runs * 99, 100) - 1],
+        .max = times[runs - 1],
+    };
+    num_repeat_stats++;
+}
+
+static void print_repeat_stats(void)
+{
+    if (num_repeat_stats == 0) {
+        return;
+    }
+
+    printf("Ran each test %d times:\n", CONFIG_REPEAT_COUNT);
+    for (int i = 0; i < num_repeat_stats; i++) {
+        struct repeat_stats *stats = &repeat_stats[i];
+        printf("\t%s: %d/%d passed", stats->name, stats->passes, stats->runs);
+        if (test_timestamp_units() != NULL) {
+            printf(", min ");
+            print_test_time(stats->min);
+            printf(", median ");
+            print_test_time(stats->median);
+            printf(", p99 ");
+            print_test_time(stats->p99);
+            printf(", max ");
+            print_test_time(stats->max);
+        }
+        printf("\n");
+    }
+}
+
+/* Untyped memory used by the current test, if its test process reported it.
+ * See CONFIG_MEMORY_ACCOUNTING. */
+static test_memory_t current_test_memory;
+static bool current_test_has_memory;
+/* the test that used the most memory so far, and the number of tests that used
+ * more than CONFIG_MEMORY_BUDGET */
+static const char *biggest_memory_test;
+static uint64_t biggest_memory_bytes;
+static int tests_over_memory_budget;
+
+static const char *object_type_names[seL4_NonArchObjectTypeCount] = {
+    [seL4_UntypedObject] = "untyped",
+    [seL4_TCBObject] = "tcb",
+    [seL4_EndpointObject] = "endpoint",
+    [seL4_NotificationObject] = "notification",
+    [seL4_CapTableObject] = "cnode",
+#ifdef CONFIG_KERNEL_MCS
+    [seL4_SchedContextObject] = "sched_context",
+    [seL4_ReplyObject] = "reply",
+#endif
+};
+
+void sel4test_record_memory(const test_memory_t *memory)
+{
+    current_test_memory = *memory;
+    current_test_has_memory = true;
+}
+
+static bool over_memory_budget(const test_memory_t *memory)
+{
+    return CONFIG_MEMORY_BUDGET > 0 && memory->peak_bytes > (uint64_t) CONFIG_MEMORY_BUDGET * 1024;
+}
+
+static void print_test_memory(const test_memory_t *memory)
+{
+    printf("Test %s used at most %llu bytes of untyped memory, allocating", current_test_name,
+           (unsigned long long) memory->peak_bytes);
+    for (int i = 0; i < seL4_ObjectTypeCount; i++) {
+        if (memory->objects[i] == 0) {
+            continue;
+        }
+        if (i < seL4_NonArchObjectTypeCount) {
+            printf(" %s %u", object_type_names[i], memory->objects[i]);
+        } else {
+            printf(" type%d %u", i, memory->objects[i]);
+        }
+    }
+    printf("\n");
+}
+
+static void print_test_memory_xml(const test_memory_t *memory)
+{
+    printf("\t\t\t<property name=\"peak_untyped_bytes\" value=\"%llu\"/>\n",
+           (unsigned long long) memory->peak_bytes);
+    for (int i = 0; i < seL4_ObjectTypeCount; i++) {
+        if (memory->objects[i] == 0) {
+            continue;
+        }
+        if (i < seL4_NonArchObjectTypeCount) {
+            printf("\t\t\t<property name=\"objects_%s\" value=\"%u\"/>\n", object_type_names[i],
+                   memory->objects[i]);
+        } else {
+            printf("\t\t\t<property name=\"objects_type%d\" value=\"%u\"/>\n", i, memory->objects[i]);
+        }
+    }
+    if (over_memory_budget(memory)) {
+        printf("\t\t\t<property name=\"over_memory_budget\" value=\"true\"/>\n");
+    }
+}
+
+/* Report the memory used by the test that just ended and flag it if it went
+ * over the budget. The flag is printed even in quiet mode. */
+static void end_test_memory(void)
+{
+    if (!current_test_has_memory) {
+        return;
+    }
+    const test_memory_t *memory = &current_test_memory;
+    if (memory->peak_bytes > biggest_memory_bytes) {
+        biggest_memory_test = current_test_name;
+        biggest_memory_bytes = memory->peak_bytes;
+    }
+    if (config_set(CONFIG_BINARY_RESULTS)) {
+        result_sample("peak_untyped_bytes", memory->peak_bytes);
+    }
+    if (over_memory_budget(memory)) {
+        tests_over_memory_budget++;
+        if (config_set(CONFIG_BINARY_RESULTS)) {
+            result_sample("over_memory_budget", 1);
+        } else if (!config_set(CONFIG_PRINT_XML)) {
+            printf("Test %s used %llu KiB of untyped memory, more than the budget of %d KiB\n", current_test_name,
+                   (unsigned long long)(memory->peak_bytes / 1024), CONFIG_MEMORY_BUDGET);
+        }
+    }
+}
+
+static void print_memory_summary(void)
+{
+    if (biggest_memory_test == NULL) {
+        return;
+    }
+    printf("Most untyped memory used by a test: %llu bytes by %s\n", (unsigned long long) biggest_memory_bytes,
+           biggest_memory_test);
+    if (CONFIG_MEMORY_BUDGET > 0) {
+        printf("%d tests used more than the untyped memory budget of %d KiB\n", tests_over_memory_budget,
+               CONFIG_MEMORY_BUDGET);
+    }
+}
+
+/* Output of the current test when QUIET_OUTPUT is set, which is only printed
+ * if the test fails */
+static log_ring_t quiet_log;
+static write_buf_fn quiet_console_write;
+/* whether stdout is currently going to quiet_log */
+static bool quiet_capturing;
+/* tests reported so far, and how many of them failed */
+static int quiet_tests_done;
+static int quiet_tests_failed;
+
+static size_t quiet_log_write(void *data, size_t count)
+{
+    log_ring_write(&quiet_log, data, count, NULL);
+    return count;
+}
+
+/* Send the output of the test that just finished to the console if it failed,
+ * and print the progress every CONFIG_QUIET_PROGRESS_INTERVAL tests. */
+static void quiet_end_test(bool failed)
+{
+    sel4muslcsys_register_stdio_write_fn(quiet_console_write);
+    quiet_capturing = false;
+    quiet_tests_done++;
+    if (failed) {
+        quiet_tests_failed++;
+        uint64_t lost = log_ring_replay(&quiet_log, quiet_console_write);
+        if (lost > 0) {
+            printf("(%llu bytes of output from the start of the test were lost)\n", (unsigned long long) lost);
+        }
+    }
+    log_ring_reset(&quiet_log);
+    if (CONFIG_QUIET_PROGRESS_INTERVAL > 0 && quiet_tests_done % CONFIG_QUIET_PROGRESS_INTERVAL == 0) {
+        printf("Ran %d tests, %d failed\n", quiet_tests_done, quiet_tests_failed);
+    }
+}
+
+/* override abort, called by exit (and assert fail), so that the output of a
+ * test that is being held back is printed if the driver halts during it */
+void abort(void)
+{
+    if (quiet_capturing) {
+        quiet_capturing = false;
+        sel4muslcsys_register_stdio_write_fn(quiet_console_write);
+        log_ring_replay(&quiet_log, quiet_console_write);
+    }
+    seL4_TCB_Suspend(seL4_CapInitThreadTCB);
+    while (1);
+}
+
 void sel4test_start_test(const char *name, int n)
 {
-    if (config_set(CONFIG_PRINT_XML)) {
+    /* the record is printed even if the test's output is held back */
+    if (config_set(CONFIG_BINARY_RESULTS)) {
+        result_test_start(name, n);
+    }
+    if (QUIET_OUTPUT) {
+        quiet_console_write = sel4muslcsys_register_stdio_write_fn(quiet_log_write);
+        quiet_capturing = true;
+    }
+    if (config_set(CONFIG_BINARY_RESULTS)) {
+        /* already reported */
+    } else if (config_set(CONFIG_PRINT_XML)) {
         printf("\t<testcase classname=\"%s\" name=\"%s\">\n", "sel4test", name);
     } else {
         printf("Starting test %d: %s\n", n, name);
     }
+    current_test_name = name;
+    current_test_has_memory = false;
     sel4test_reset();
     sel4test_start_printf_buffer();
 }
 
-void sel4test_end_test(test_result_t result)
+void sel4test_end_test(test_result_t result, const test_times_t *times)
 {
     sel4test_end_printf_buffer();
-    test_check(result == SUCCESS);
+    if (result == TIMEOUT) {
+        if (config_set(CONFIG_BINARY_RESULTS)) {
+            /* the result record says so */
+        } else if (config_set(CONFIG_PRINT_XML)) {
+            printf("\t\t<failure type=\"TIMEOUT\">Test did not finish within its time budget</failure>\n");
+        } else {
+            printf("Test %s timed out\n", current_test_name);
+        }
+    } else {
+        test_check(result == SUCCESS);
+    }
+
+    if (times != NULL && test_timestamp_units() != NULL) {
+        record_test_times(current_test_name, times);
+        /* otherwise the times go in the result record or the XML properties */
+        if (!config_set(CONFIG_BINARY_RESULTS) && !config_set(CONFIG_PRINT_XML)) {
+            printf("Test %s took", current_test_name);
+            for (int i = 0; i < NUM_TEST_PHASES; i++) {
+                printf("%s %s ", i ? "," : "", test_phase_names[i]);
+                print_test_time(times->phase[i]);
+            }
+            printf("\n");
+        }
+    }
 
-    if (config_set(CONFIG_PRINT_XML)) {
+    if (!config_set(CONFIG_PRINT_XML) && !config_set(CONFIG_BINARY_RESULTS) && current_test_has_memory) {
+        print_test_memory(&current_test_memory);
+    }
+
+    if (config_set(CONFIG_PRINT_XML) && !config_set(CONFIG_BINARY_RESULTS)) {
+        /* the testcase tag is printed before the test runs, so the times
+         * can't go in its attributes */
+        bool xml_times = times != NULL && test_timestamp_units() != NULL &&
+                         strcmp(test_timestamp_units(), "ns") == 0;
+        if (xml_times || current_test_has_memory) {
+            printf("\t\t<properties>\n");
+        }
+        if (xml_times) {
+            uint64_t total = 0;
+            for (int i = 0; i < NUM_TEST_PHASES; i++) {
+                total += times->phase[i];
+                printf("\t\t\t<property name=\"%s_ns\" value=\"%llu\"/>\n", test_phase_names[i],
+                       (unsigned long long) times->phase[i]);
+            }
+            printf("\t\t\t<property name=\"time\" value=\"%llu.%09llu\"/>\n",
+                   (unsigned long long)(total / NS_IN_S), (unsigned long long)(total % NS_IN_S));
+        }
+        if (current_test_has_memory) {
+            print_test_memory_xml(&current_test_memory);
+        }
+        if (xml_times || current_test_has_memory) {
+            printf("\t\t</properties>\n");
+        }
         printf("\t</testcase>\n");
     }
 
     if (config_set(CONFIG_HAVE_TIMER)) {
         timer_reset(&env);
     }
+
+    if (QUIET_OUTPUT) {
+        quiet_end_test(result != SUCCESS || sel4test_get_result() != SUCCESS);
+    }
+
+    end_test_memory();
+
+    if (config_set(CONFIG_BINARY_RESULTS)) {
+        result_test_end(result != SUCCESS ? result : sel4test_get_result(), times);
+    }
 }
 
 void sel4test_end_suite(int num_tests, int num_tests_passed, int skipped_tests)
 {
-    if (config_set(CONFIG_PRINT_XML)) {
+    if (config_set(CONFIG_BINARY_RESULTS)) {
+        result_suite_end(num_tests, num_tests_passed, skipped_tests);
+    } else if (config_set(CONFIG_PRINT_XML)) {
         printf("</testsuite>\n");
     } else {
         if (num_tests_passed != num_tests) {
@@ -262,10 +743,33 @@ void sel4test_stop_tests(test_result_t result, int tests_done, int tests_failed,
     }
     tests_done++;
     num_tests++;
-    sel4test_end_test(sel4test_get_result());
+    sel4test_end_test(sel4test_get_result(), NULL);
 
     sel4test_end_suite(tests_done, tests_done - tests_failed, skipped_tests);
 
+    if (config_set(CONFIG_BINARY_RESULTS)) {
+        /* the summaries can be worked out from the test records, so only send
+         * what can't be */
+        if (config_set(CONFIG_TIMER_LATENCY)) {
+            result_timer_latency(&env);
+        }
+        if (config_set(CONFIG_REVOKE_USED_UNTYPEDS)) {
+            result_sample("untyped_revokes", env.untyped_revokes);
+            result_sample("untyped_revokes_skipped", env.untyped_revokes_skipped);
+        }
+    } else if (!config_set(CONFIG_PRINT_XML)) {
+        print_repeat_stats();
+        print_slowest_tests();
+        print_memory_summary();
+        if (config_set(CONFIG_TIMER_LATENCY)) {
+            print_timer_latency(&env);
+        }
+        if (config_set(CONFIG_REVOKE_USED_UNTYPEDS)) {
+            printf("Revoked %d untypeds, skipped %d unused untypeds\n", env.untyped_revokes,
+                   env.untyped_revokes_skipped);
+        }
+    }
+
     if (tests_failed > 0) {
         printf("*** FAILURES DETECTED ***\n");
     } else if (tests_done < num_tests) {
@@ -276,13 +780,66 @@ void sel4test_stop_tests(test_result_t result, int tests_done, int tests_failed,
     printf("\n\n");
 }
 
+const test_metadata_t *sel4test_get_test_metadata(const char *name)
+{
+    for (int i = 0; i < env.num_images; i++) {
+        test_image_t *image = &env.images[i];
+        for (int j = 0; j < image->num_metadata; j++) {
+            if (strncmp(image->metadata[j].name, name, TEST_NAME_MAX) == 0) {
+                return &image->metadata[j];
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Whether a space separated list contains a word */
+static bool list_has_word(const char *list, const char *word, size_t len)
+{
+    while (*list != '\0') {
+        list += strspn(list, " ");
+        size_t n = strcspn(list, " ");
+        if (n == len && strncmp(list, word, len) == 0) {
+            return true;
+        }
+        list += n;
+    }
+    return false;
+}
+
+/* Whether a test has one of the tags in CONFIG_TEST_TAGS, always true if no tags are set */
+static bool test_selected_by_tags(const char *name)
+{
+    if (CONFIG_TEST_TAGS[0] == '\0') {
+        return true;
+    }
+    const test_metadata_t *metadata = sel4test_get_test_metadata(name);
+    if (metadata == NULL) {
+        return false;
+    }
+
+    /* the tags in the tests image may not be null terminated */
+    char tags[TEST_TAGS_MAX + 1];
+    memcpy(tags, metadata->tags, TEST_TAGS_MAX);
+    tags[TEST_TAGS_MAX] = '\0';
+    for (char *tag = tags; *tag != '\0';) {
+        tag += strspn(tag, " ");
+        size_t len = strcspn(tag, " ");
+        if (len > 0 && list_has_word(CONFIG_TEST_TAGS, tag, len)) {
+            return true;
+        }
+        tag += len;
+    }
+    return false;
+}
+
 static int collate_tests(testcase_t *tests_in, int n, testcase_t *tests_out[], int out_index,
                          regex_t *reg, int *skipped_tests)
 {
     for (int i = 0; i < n; i++) {
         /* make sure the string is null terminated */
         tests_in[i].name[TEST_NAME_MAX - 1] = '\0';
-        if (regexec(reg, tests_in[i].name, 0, NULL, 0) == 0) {
+        if (regexec(reg, tests_in[i].name, 0, NULL, 0) == 0 && test_selected_by_tags(tests_in[i].name)) {
             if (tests_in[i].enabled) {
                 tests_out[out_index] = &tests_in[i];
                 out_index++;
@@ -295,6 +852,133 @@ static int collate_tests(testcase_t *tests_in, int n, testcase_t *tests_out[], i
     return out_index;
 }
 
+/* A test to be dealt out to a shard */
+struct shard_test {
+    uint64_t duration;
+    int index;
+};
+
+/* Sort tests longest first, keeping the sorted order of tests with the same duration */
+static int shard_test_comparator(const void *a, const void *b)
+{
+    const struct shard_test *ta = a;
+    const struct shard_test *tb = b;
+    if (ta->duration != tb->duration) {
+        return ta->duration < tb->duration ? 1 : -1;
+    }
+    return ta->index - tb->index;
+}
+
+/* Expected duration of a test in us, or 0 if it isn't known. Measured durations
+ * take precedence over the test's own estimate in its metadata. */
+static uint64_t test_duration(const char *name)
+{
+    for (const struct test_duration *d = test_durations; d->name != NULL; d++) {
+        if (strcmp(d->name, name) == 0) {
+            return d->us;
+        }
+    }
+    const test_metadata_t *metadata = sel4test_get_test_metadata(name);
+    return metadata != NULL ? metadata->runtime_us : 0;
+}
+
+/* Remove the tests that don't belong to this shard from a sorted list of tests,
+ * returning the number of tests left. Each test in turn, longest first, goes to
+ * the shard with the least expected time so far. Tests without a known duration
+ * are expected to take the average time, so without any durations the tests are
+ * simply dealt out one at a time. */
+static int shard_tests(testcase_t *tests[], int num_tests)
+{
+    compile_time_assert(shard_index_valid, CONFIG_SHARD_INDEX < CONFIG_SHARD_COUNT);
+    if (CONFIG_SHARD_COUNT <= 1 || num_tests == 0) {
+        return num_tests;
+    }
+
+    struct shard_test order[num_tests];
+    uint64_t known_total = 0;
+    int num_known = 0;
+    for (int i = 0; i < num_tests; i++) {
+        order[i].index = i;
+        order[i].duration = test_duration(tests[i]->name);
+        if (order[i].duration != 0) {
+            known_total += order[i].duration;
+            num_known++;
+        }
+    }
+    uint64_t average = num_known ? MAX(known_total / num_known, 1) : 1;
+    for (int i = 0; i < num_tests; i++) {
+        if (order[i].duration == 0) {
+            order[i].duration = average;
+        }
+    }
+    qsort(order, num_tests, sizeof(struct shard_test), shard_test_comparator);
+
+    uint64_t shard_time[CONFIG_SHARD_COUNT] = {0};
+    bool mine[num_tests];
+    for (int i = 0; i < num_tests; i++) {
+        int shard = 0;
+        for (int j = 1; j < CONFIG_SHARD_COUNT; j++) {
+            if (shard_time[j] < shard_time[shard]) {
+                shard = j;
+            }
+        }
+        shard_time[shard] += order[i].duration;
+        mine[order[i].index] = shard == CONFIG_SHARD_INDEX;
+    }
+
+    /* keep the tests for this shard in their sorted order */
+    int num_shard_tests = 0;
+    for (int i = 0; i < num_tests; i++) {
+        if (mine[i]) {
+            tests[num_shard_tests] = tests[i];
+            num_shard_tests++;
+        }
+    }
+
+    printf("Running shard %d of %d: %d of %d tests\n", CONFIG_SHARD_INDEX, CONFIG_SHARD_COUNT, num_shard_tests,
+           num_tests);
+    return num_shard_tests;
+}
+
+/* Whether any of a list of tests say they use the device frame */
+static bool tests_need_device_frame(testcase_t *tests[], int num_tests)
+{
+    for (int i = 0; i < num_tests; i++) {
+        const test_metadata_t *metadata = sel4test_get_test_metadata(tests[i]->name);
+        if (metadata != NULL && metadata->needs_device_frame) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Run a single test from start to finish and report it. The total time taken is returned in time. */
+static test_result_t run_test(struct test_type *test_type, testcase_t *test, struct driver_env *e, int n,
+                              uint64_t *time)
+{
+    test_times_t times;
+    sel4test_start_test(test->name, n);
+    e->current_test = test;
+    uint64_t phase_start = test_timestamp(e);
+    if (test_type->set_up != NULL) {
+        test_type->set_up((uintptr_t)e);
+    }
+    times.phase[TEST_PHASE_SET_UP] = test_time_elapsed(e, &phase_start);
+
+    test_result_t result = test_type->run_test(test, (uintptr_t)e);
+    times.phase[TEST_PHASE_RUN] = test_time_elapsed(e, &phase_start);
+
+    if (test_type->tear_down != NULL) {
+        test_type->tear_down((uintptr_t)e);
+    }
+    times.phase[TEST_PHASE_TEAR_DOWN] = test_time_elapsed(e, &phase_start);
+    e->current_test = NULL;
+    sel4test_end_test(result, &times);
+
+    *time = times.phase[TEST_PHASE_SET_UP] + times.phase[TEST_PHASE_RUN] + times.phase[TEST_PHASE_TEAR_DOWN];
+    return result;
+}
+
 void sel4test_run_tests(struct driver_env *e)
 {
     /* Iterate through test types. */
@@ -311,12 +995,10 @@ void sel4test_run_tests(struct driver_env *e)
 
     /* Count how many tests actually exist and allocate space for them */
     int driver_tests = (int)(__stop__test_case - __start__test_case);
-    uint64_t tc_size = 0;
-    testcase_t *sel4test_tests = (testcase_t *) sel4utils_elf_get_section(&tests_elf, "_test_case", &tc_size);
-    if (sel4test_tests == NULL) {
-        ZF_LOGF(TESTS_APP": Failed to find section: _test_case");
+    int tc_tests = 0;
+    for (int i = 0; i < e->num_images; i++) {
+        tc_tests += e->images[i].num_tests;
     }
-    int tc_tests = tc_size / sizeof(testcase_t);
     int all_tests = driver_tests + tc_tests;
     testcase_t *tests[all_tests];
 
@@ -328,8 +1010,10 @@ void sel4test_run_tests(struct driver_env *e)
     int skipped_tests = 0;
     /* get all the tests in the test case section in the driver */
     int num_tests = collate_tests(__start__test_case, driver_tests, tests, 0, &reg, &skipped_tests);
-    /* get all the tests in the sel4test_tests app */
-    num_tests = collate_tests(sel4test_tests, tc_tests, tests, num_tests, &reg, &skipped_tests);
+    /* get all the tests in the sel4test_tests images */
+    for (int i = 0; i < e->num_images; i++) {
+        num_tests = collate_tests(e->images[i].tests, e->images[i].num_tests, tests, num_tests, &reg, &skipped_tests);
+    }
 
     /* finished with regex */
     regfree(&reg);
@@ -339,21 +1023,53 @@ void sel4test_run_tests(struct driver_env *e)
 
     /* Now that they are sorted we can easily ensure there are no duplicate tests.
      * this just ensures some sanity as if there are duplicates, they could have some
-     * arbitrary ordering, which might result in difficulty reproducing test failures */
-    for (int i = 1; i < num_tests; i++) {
-        ZF_LOGF_IF(strcmp(tests[i]->name, tests[i - 1]->name) == 0, "tests have no strict order! %s %s",
-                   tests[i]->name, tests[i - 1]->name);
+     * arbitrary ordering, which might result in difficulty reproducing test failures.
+     * Tests from libraries that every image links are in each image, so only the
+     * copy in the first image is kept. */
+    int unique_tests = 0;
+    for (int i = 0; i < num_tests; i++) {
+        if (unique_tests > 0 && strcmp(tests[i]->name, tests[unique_tests - 1]->name) == 0) {
+            test_image_t *image = image_of_test(e, tests[i]);
+            test_image_t *kept = image_of_test(e, tests[unique_tests - 1]);
+            ZF_LOGF_IF(image == NULL || kept == NULL || image == kept, "tests have no strict order! %s %s",
+                       tests[i]->name, tests[unique_tests - 1]->name);
+            if (image < kept) {
+                tests[unique_tests - 1] = tests[i];
+            }
+            continue;
+        }
+        tests[unique_tests] = tests[i];
+        unique_tests++;
+    }
+    num_tests = unique_tests;
+
+    /* Only keep this shard's tests. This happens after sorting so that every
+     * shard agrees on which tests belong to it */
+    num_tests = shard_tests(tests, num_tests);
+    boot_phase_done("select tests");
+
+    /* spike doesn't have any device untypeds so the tests that require them are turned off */
+    if (!config_set(CONFIG_PLAT_SPIKE) && tests_need_device_frame(tests, num_tests)) {
+        alloc_device_frame();
+        boot_phase_done("device frame");
     }
+    print_boot_phases();
 
     /* Check that we don't miss any tests because of an undeclared test type */
     int tests_done = 0;
     int tests_failed = 0;
 
+    compile_time_assert(repeat_count_valid, CONFIG_REPEAT_COUNT >= 1);
+    if (CONFIG_REPEAT_COUNT > 1) {
+        repeat_stats = calloc(num_tests, sizeof(struct repeat_stats));
+        ZF_LOGF_IF(repeat_stats == NULL, "Failed to allocate repeat statistics");
+    }
+
     sel4test_start_suite("sel4test");
     /* First: test that there are tests to run */
     sel4test_start_test("Test that there are tests", tests_done);
     test_gt(num_tests, 0);
-    sel4test_end_test(sel4test_get_result());
+    sel4test_end_test(sel4test_get_result(), NULL);
     tests_done++;
 
     /* Iterate through test types so that we run them in order of test type, then name.
@@ -364,28 +1080,44 @@ void sel4test_run_tests(struct driver_env *e)
             test_types[tt]->set_up_test_type((uintptr_t)e);
         }
 
-        for (int i = 0; i < num_tests; i++) {
-            if (tests[i]->test_type == test_types[tt]->id) {
-                sel4test_start_test(tests[i]->name, tests_done);
-                if (test_types[tt]->set_up != NULL) {
-                    test_types[tt]->set_up((uintptr_t)e);
-                }
-
-                test_result_t result = test_types[tt]->run_test(tests[i], (uintptr_t)e);
-
-                if (test_types[tt]->tear_down != NULL) {
-                    test_types[tt]->tear_down((uintptr_t)e);
-                }
-                sel4test_end_test(result);
-
-                if (result != SUCCESS) {
-                    tests_failed++;
-                    if (config_set(CONFIG_TESTPRINTER_HALT_ON_TEST_FAILURE) || result == ABORT) {
-                        sel4test_stop_tests(result, tests_done + 1, tests_failed, num_tests + 1, skipped_tests);
-                        return;
+        if (config_set(CONFIG_PARALLEL_TESTS) && CONFIG_REPEAT_COUNT == 1 && test_types[tt]->id == BASIC) {
+            /* BASIC tests get spread across the cores and reported as they finish */
+            test_result_t result = basic_run_tests_parallel(e, tests, num_tests, &tests_done, &tests_failed);
+            if (result != SUCCESS) {
+                sel4test_stop_tests(result, tests_done, tests_failed, num_tests + 1, skipped_tests);
+                return;
+            }
+        } else {
+            for (int i = 0; i < num_tests; i++) {
+                if (tests[i]->test_type == test_types[tt]->id) {
+                    /* a test fails if any of its runs fail */
+                    test_result_t result = SUCCESS;
+                    uint64_t times[CONFIG_REPEAT_COUNT];
+                    int runs = 0;
+                    int passes = 0;
+                    while (runs < CONFIG_REPEAT_COUNT) {
+                        test_result_t run_result = run_test(test_types[tt], tests[i], e, tests_done, &times[runs]);
+                        runs++;
+                        if (run_result == SUCCESS) {
+                            passes++;
+                        } else {
+                            result = run_result;
+                            if (config_set(CONFIG_TESTPRINTER_HALT_ON_TEST_FAILURE) || result == ABORT) {
+                                break;
+                            }
+                        }
+                    }
+                    record_repeat_stats(tests[i]->name, passes, times, runs);
+
+                    if (result != SUCCESS) {
+                        tests_failed++;
+                        if (config_set(CONFIG_TESTPRINTER_HALT_ON_TEST_FAILURE) || result == ABORT) {
+                            sel4test_stop_tests(result, tests_done + 1, tests_failed, num_tests + 1, skipped_tests);
+                            return;
+                        }
                     }
+                    tests_done++;
                 }
-                tests_done++;
             }
         }
 
@@ -401,17 +1133,11 @@ void sel4test_run_tests(struct driver_env *e)
 
 void *main_continued(void *arg UNUSED)
 {
+    boot_phase_done("stack switch");
 
-    /* elf region data */
-    int num_elf_regions;
-    sel4utils_elf_region_t elf_regions[MAX_REGIONS];
-
-    unsigned long elf_size;
     unsigned long cpio_len = _cpio_archive_end - _cpio_archive;
-    const void *elf_file = cpio_get_file(_cpio_archive, cpio_len, TESTS_APP, &elf_size);
-    ZF_LOGF_IF(elf_file == NULL, "Error: failed to lookup ELF file");
-    int status = elf_newFile(elf_file, elf_size, &tests_elf);
-    ZF_LOGF_IF(status, "Error: invalid ELF file");
+    image_find_all(&env, _cpio_archive, cpio_len);
+    boot_phase_done("find tests images");
 
     /* Print welcome banner. */
     printf("\n");
@@ -421,48 +1147,32 @@ void *main_continued(void *arg UNUSED)
 
     int error;
 
-    /* allocate a piece of device untyped memory for the frame tests,
-     * note that spike doesn't have any device untypes so the tests that require device untypes are turned off */
-    if (!config_set(CONFIG_PLAT_SPIKE)) {
-        bool allocated = false;
-        int untyped_count = simple_get_untyped_count(&env.simple);
-        for (int i = 0; i < untyped_count; i++) {
-            bool device = false;
-            uintptr_t ut_paddr = 0;
-            size_t ut_size_bits = 0;
-            seL4_CPtr ut_cptr = simple_get_nth_untyped(&env.simple, i, &ut_size_bits, &ut_paddr, &device);
-            if (device) {
-                error = vka_alloc_frame_at(&env.vka, seL4_PageBits, ut_paddr, &env.device_obj);
-                if (!error) {
-                    allocated = true;
-                    /* we've allocated a single device frame and that's all we need */
-                    break;
-                }
-            }
-        }
-        ZF_LOGF_IF(allocated == false, "Failed to allocate a device frame for the frame tests");
-    }
-
     /* allocate lots of untyped memory for tests to use */
     env.num_untypeds = populate_untypeds(untypeds);
     env.untypeds = untypeds;
+    boot_phase_done("untypeds");
 
     /* create a frame that will act as the init data, we can then map that
      * in to target processes */
     env.init = (test_init_data_t *) vspace_new_pages(&env.vspace, seL4_AllRights, 1, PAGE_BITS_4K);
     assert(env.init != NULL);
 
+    /* and the ring the test process in the first slot writes its output to */
+    if (config_set(CONFIG_LOG_RING)) {
+        env.log = (log_ring_t *) vspace_new_pages(&env.vspace, seL4_AllRights, LOG_RING_PAGES, PAGE_BITS_4K);
+        ZF_LOGF_IF(env.log == NULL, "Failed to allocate log ring");
+    }
+
     /* copy the untyped size bits list across to the init frame */
     memcpy(env.init->untyped_size_bits_list, untyped_size_bits_list, sizeof(uint8_t) * env.num_untypeds);
 
-    /* parse elf region data about the test image to pass to the tests app */
-    num_elf_regions = sel4utils_elf_num_regions(&tests_elf);
-    assert(num_elf_regions <= MAX_REGIONS);
-    sel4utils_elf_reserve(NULL, &tests_elf, elf_regions);
-
-    /* copy the region list for the process to clone itself */
-    memcpy(env.init->elf_regions, elf_regions, sizeof(sel4utils_elf_region_t) * num_elf_regions);
-    env.init->num_elf_regions = num_elf_regions;
+    /* load the tests images once so each test process only needs its writable regions copied */
+    if (config_set(CONFIG_PROCESS_TEMPLATE)) {
+        for (int i = 0; i < env.num_images; i++) {
+            image_init(&env, &env.images[i]);
+        }
+        boot_phase_done("load tests images");
+    }
 
     /* setup init data that won't change test-to-test */
     env.init->priority = seL4_MaxPrio - 1;
@@ -470,11 +1180,19 @@ void *main_continued(void *arg UNUSED)
         plat_init(&env);
     }
 
+    /* publish the time to test processes, which needs the TSC frequency on x86 */
+    if (config_set(CONFIG_CLOCK_PAGE)) {
+        env.clock = (clock_page_t *) vspace_new_pages(&env.vspace, seL4_AllRights, 1, PAGE_BITS_4K);
+        ZF_LOGF_IF(env.clock == NULL, "Failed to allocate clock page");
+        clock_page_update(&env);
+    }
+
     /* Allocate a reply object for the RT kernel. */
     if (config_set(CONFIG_KERNEL_MCS)) {
         error = vka_alloc_reply(&env.vka, &env.reply);
         ZF_LOGF_IF(error, "Failed to allocate reply");
     }
+    boot_phase_done("init data");
 
     /* now run the tests */
     sel4test_run_tests(&env);
@@ -583,6 +1301,8 @@ static irq_id_t sel4test_timer_irq_register(UNUSED void *cookie, ps_irq_t irq, i
     /* Fill out information about the callbacks */
     env.timer_cbs[num_timer_irqs].callback = callback;
     env.timer_cbs[num_timer_irqs].callback_data = callback_data;
+    env.timer_acks[num_timer_irqs].env = &env;
+    env.timer_acks[num_timer_irqs].nth_timer = num_timer_irqs;
 
     return num_timer_irqs++;
 }
@@ -597,6 +1317,7 @@ int main(void)
 {
     /* Set exit handler */
     sel4runtime_set_exit(sel4test_exit);
+    boot_start = boot_timestamp();
 
     int error;
     seL4_BootInfo *info = platsupport_get_bootinfo();
@@ -613,6 +1334,7 @@ int main(void)
      * manager, timer
      */
     init_env(&env);
+    boot_phase_done("init env");
 
     /* Partially overwrite part of the VKA implementation to cache objects. We need to
      * create this wrapper as the actual vka implementation will only
@@ -633,6 +1355,7 @@ int main(void)
     serial_utspace_record = true;
     platsupport_serial_setup_simple(&env.vspace, &env.simple, &env.vka);
     serial_utspace_record = false;
+    boot_phase_done("serial");
 
     /* Partially overwrite the IRQ interface so that we can record the IRQ caps that were allocated.
      * We need this only for the timer as the ltimer interfaces allocates the caps for us and hides them away.
@@ -644,8 +1367,12 @@ int main(void)
     init_timer();
     /* Restore the IRQ interface's register function */
     env.ops.irq_ops.irq_register_fn = irq_register_fn_copy;
+    boot_phase_done("timer");
 
-    simple_print(&env.simple);
+    if (config_set(CONFIG_PRINT_BOOTINFO) && !QUIET_OUTPUT) {
+        simple_print(&env.simple);
+        boot_phase_done("print bootinfo");
+    }
 
     /* switch to a bigger, safer stack with a guard page
      * before starting the tests */
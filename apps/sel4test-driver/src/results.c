@@ -0,0 +1,149 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Include Kconfig variables. */
+#include <autoconf.h>
+#include <sel4test-driver/gen_config.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <utils/util.h>
+
+#include "results.h"
+#include "timer.h"
+
+/* Largest record: the type, a number and a test name or the result and times
+ * of a test, and the CRC */
+#define RESULT_MAX_BYTES (1 + 10 + MAX(TEST_NAME_MAX, 2 + NUM_TEST_PHASES * 10) + 4)
+
+struct result_record {
+    uint8_t data[RESULT_MAX_BYTES];
+    size_t len;
+};
+
+static void put_byte(struct result_record *record, uint8_t byte)
+{
+    assert(record->len < RESULT_MAX_BYTES);
+    record->data[record->len] = byte;
+    record->len++;
+}
+
+static void put_number(struct result_record *record, uint64_t value)
+{
+    do {
+        uint8_t byte = value & MASK(7);
+        value >>= 7;
+        put_byte(record, value ? byte | BIT(7) : byte);
+    } while (value);
+}
+
+static void put_string(struct result_record *record, const char *string)
+{
+    for (; *string != '\0' && record->len < RESULT_MAX_BYTES - 4; string++) {
+        put_byte(record, *string);
+    }
+}
+
+static uint32_t crc32(const uint8_t *data, size_t len)
+{
+    /* CRC-32 (IEEE 802.3) of each value of a nibble */
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ data[i]) & 0xf] ^ (crc >> 4);
+        crc = table[(crc ^ (data[i] >> 4)) & 0xf] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+/* Add the CRC to a record and print it */
+static void put_record(struct result_record *record)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char line[sizeof(RESULT_MARKER) + DIV_ROUND_UP(RESULT_MAX_BYTES, 3) * 4];
+    size_t pos = 0;
+
+    uint32_t crc = crc32(record->data, record->len);
+    for (int i = 0; i < 4; i++) {
+        put_byte(record, crc >> (i * 8));
+    }
+
+    strcpy(line, RESULT_MARKER);
+    pos += strlen(RESULT_MARKER);
+    for (size_t i = 0; i < record->len; i += 3) {
+        uint32_t group = record->data[i] << 16;
+        if (i + 1 < record->len) {
+            group |= record->data[i + 1] << 8;
+        }
+        if (i + 2 < record->len) {
+            group |= record->data[i + 2];
+        }
+        /* only as many characters as there are bytes, plus one */
+        for (size_t j = 0; j <= MIN(record->len - i, 3); j++) {
+            line[pos] = alphabet[(group >> (18 - j * 6)) & MASK(6)];
+            pos++;
+        }
+    }
+    line[pos] = '\0';
+    printf("%s\n", line);
+}
+
+void result_suite_start(void)
+{
+    struct result_record record = {0};
+    put_byte(&record, RESULT_SUITE_START);
+    put_record(&record);
+}
+
+void result_test_start(const char *name, int n)
+{
+    struct result_record record = {0};
+    put_byte(&record, RESULT_TEST_START);
+    put_number(&record, n);
+    put_string(&record, name);
+    put_record(&record);
+}
+
+void result_test_end(test_result_t result, const test_times_t *times)
+{
+    struct result_record record = {0};
+    put_byte(&record, RESULT_TEST_END);
+    put_byte(&record, result);
+    const char *units = test_timestamp_units();
+    if (times == NULL || units == NULL) {
+        put_byte(&record, 0);
+    } else {
+        put_byte(&record, strcmp(units, "ns") == 0 ? 1 : 2);
+        for (int i = 0; i < NUM_TEST_PHASES; i++) {
+            put_number(&record, times->phase[i]);
+        }
+    }
+    put_record(&record);
+}
+
+void result_suite_end(int num_tests, int num_tests_passed, int skipped_tests)
+{
+    struct result_record record = {0};
+    put_byte(&record, RESULT_SUITE_END);
+    put_number(&record, num_tests);
+    put_number(&record, num_tests_passed);
+    put_number(&record, skipped_tests);
+    put_record(&record);
+}
+
+void result_sample(const char *name, uint64_t value)
+{
+    struct result_record record = {0};
+    put_byte(&record, RESULT_SAMPLE);
+    put_number(&record, value);
+    put_string(&record, name);
+    put_record(&record);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+#include <stdint.h>
+#include "test.h"
+
+/* Test events as compact records, used instead of text when CONFIG_BINARY_RESULTS
+ * is set. Each record is printed on its own line, starting with RESULT_MARKER and
+ * followed by the base64 encoding, without padding, of:
+ *
+ *   u8 type, the fields of that type, u32 CRC-32 of everything before it
+ *
+ * Numbers are unsigned LEB128 unless their size is given, and strings run to the
+ * CRC. Anything else on the line is ignored. scripts/decode-results.py converts
+ * the records in a log to JUnit XML or CSV. */
+#define RESULT_MARKER "@@"
+
+enum result_record_type {
+    /* no fields */
+    RESULT_SUITE_START = 1,
+    /* test number, name */
+    RESULT_TEST_START = 2,
+    /* u8 result, u8 time units (0 for no times, 1 for ns, 2 for cycles), then
+     * the time spent in each test phase if there are times */
+    RESULT_TEST_END = 3,
+    /* tests run, tests passed, tests disabled */
+    RESULT_SUITE_END = 4,
+    /* value, name */
+    RESULT_SAMPLE = 5,
+};
+
+void result_suite_start(void);
+void result_test_start(const char *name, int n);
+void result_test_end(test_result_t result, const test_times_t *times);
+void result_suite_end(int num_tests, int num_tests_passed, int skipped_tests);
+/* A measurement taken by a test, such as a benchmark sample */
+void result_sample(const char *name, uint64_t value);
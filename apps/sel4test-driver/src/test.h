@@ -22,17 +22,159 @@
 
 /* This file is shared with seltest-tests. */
 #include <test_init_data.h>
+#include <log_ring.h>
+#include <clock_page.h>
+#include "timer_wheel.h"
 
 #define TESTS_APP "sel4test-tests"
 
 #define MAX_TIMER_IRQS 4
 
+/* Number of BASIC tests that can be run at the same time */
+#ifdef CONFIG_PARALLEL_TESTS
+#define MAX_TEST_SLOTS CONFIG_MAX_NUM_NODES
+#else
+#define MAX_TEST_SLOTS 1
+#endif
+
+/* Badge of the fault endpoint given to the test process in a slot. Timer IRQs
+ * arrive on the bound notification with badges below BIT(MAX_TIMER_IRQS), so
+ * slot badges start above them. A badge of 0 means the slot owns its own
+ * unbadged fault endpoint. */
+#define TEST_SLOT_BADGE(slot) (((seL4_Word) (slot) + 1) << MAX_TIMER_IRQS)
+
+/* Result of a test that the driver stopped because it ran out of time */
+#define TIMEOUT (ABORT + 1)
+
+/* Phases of a test that the driver times */
+enum test_phase {
+    TEST_PHASE_SET_UP,
+    TEST_PHASE_RUN,
+    TEST_PHASE_TEAR_DOWN,
+    NUM_TEST_PHASES
+};
+
+/* Time spent in each phase of a test, in the units of test_timestamp */
+struct test_times {
+    uint64_t phase[NUM_TEST_PHASES];
+};
+typedef struct test_times test_times_t;
+
 struct timer_callback_info {
     irq_callback_fn_t callback;
     void *callback_data;
 };
 typedef struct timer_callback_info timer_callback_info_t;
 
+/* Token passed to a timer IRQ's callback for acknowledging it. There is one
+ * for each timer IRQ, which is enough as the IRQ can't arrive again until it
+ * has been acknowledged. */
+struct sel4test_ack_data {
+    struct driver_env *env;
+    int nth_timer;
+    bool pending;
+};
+typedef struct sel4test_ack_data sel4test_ack_data_t;
+
+/* Histogram of latencies in ns, in powers of two: bucket i counts the
+ * latencies in [2^i, 2^(i + 1)), and bucket 0 those below 2 */
+#define LATENCY_BUCKETS 40
+struct latency_hist {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t buckets[LATENCY_BUCKETS];
+};
+typedef struct latency_hist latency_hist_t;
+
+/* Most sel4test-tests images there can be in the CPIO archive */
+#define MAX_TEST_IMAGES 8
+
+/* An image in the CPIO archive with some of the sel4test-tests tests. There is
+ * only one unless CONFIG_SPLIT_TEST_IMAGES is set. */
+struct test_image {
+    /* name of the image in the CPIO archive */
+    const char *name;
+    elf_t elf;
+    /* the tests in the image and their metadata */
+    testcase_t *tests;
+    int num_tests;
+    test_metadata_t *metadata;
+    int num_metadata;
+    /* loadable regions, so test processes can launch copies of themselves */
+    sel4utils_elf_region_t elf_regions[MAX_REGIONS];
+    int num_elf_regions;
+
+    /* The rest is only used when CONFIG_PROCESS_TEMPLATE is set, and the driver
+     * loads the image once and then maps it into each new test process. */
+    /* loadable regions of the image. These double as the reservations made
+     * in each new test process, so the reservation field is only valid for
+     * the current test process. */
+    sel4utils_elf_region_t regions[MAX_REGIONS];
+    int num_regions;
+    /* pristine contents of each region, mapped into the driver's vspace */
+    void *contents[MAX_REGIONS];
+
+    void *entry_point;
+    uintptr_t sysinfo;
+
+    /* program headers, needed by the test process to find its TLS segment */
+    Elf_Phdr *phdrs;
+    int num_phdrs;
+};
+typedef struct test_image test_image_t;
+
+/* A test process and the resources handed to it */
+struct test_slot {
+    /* the test running in this slot, NULL if the slot is free */
+    struct testcase *test;
+    /* whether the test has the whole machine to itself */
+    bool exclusive;
+    /* core the test process is pinned to */
+    int core;
+    /* whether the test process is waiting to run another test */
+    bool waiting;
+    /* set by the watchdog when the test runs out of time */
+    bool timed_out;
+    /* badge of fault_endpoint, 0 if the process creates its own */
+    seL4_Word badge;
+    /* badged copy of the shared fault endpoint in the driver's cspace */
+    vka_object_t fault_endpoint;
+
+    /* init data frame vaddr */
+    test_init_data_t *init;
+    /* address of the init data frame in the test process */
+    void *remote_vaddr;
+    /* ring the test process writes its output to, and its address in the test
+     * process, only used if CONFIG_LOG_RING is set */
+    log_ring_t *log;
+    void *remote_log;
+    /* address of the clock page in the test process, if CONFIG_CLOCK_PAGE is set */
+    void *remote_clock;
+    sel4utils_process_t process;
+    /* image the test process was made from */
+    test_image_t *image;
+    /* the process' reservations of the image regions, if CONFIG_PROCESS_TEMPLATE is set */
+    sel4utils_elf_region_t image_regions[MAX_REGIONS];
+    /* root CNode of the process when CONFIG_TWO_LEVEL_CSPACE is set */
+    vka_object_t cspace_root;
+    /* fault endpoint in the test process' cspace */
+    seL4_CPtr endpoint;
+
+    /* untypeds available to the test process */
+    int num_untypeds;
+    vka_object_t *untypeds;
+    /* number of them, from the start, that were handed to the test process */
+    int untypeds_given;
+    /* CNode with copies of the untypeds, only used if CONFIG_SHARED_UNTYPED_CNODE is set */
+    vka_object_t untyped_cnode;
+
+    /* time spent on the test so far, and when its current phase started */
+    test_times_t times;
+    uint64_t phase_start;
+};
+typedef struct test_slot test_slot_t;
+
 struct driver_env {
     /* An initialised vka that may be used by the test. */
     vka_t vka;
@@ -58,6 +200,10 @@ struct driver_env {
      * before actually starting them.
      */
     vka_object_t timer_notify_test;
+    /* Notifications of each timer client of the test process, the first of
+     * which is timer_notify_test, and the badged caps the driver signals them on */
+    vka_object_t timer_client_ntfns[TIMER_CLIENTS];
+    cspacepath_t timer_client_signals[TIMER_CLIENTS];
 
     /* Only needed if we're on RT kernel */
     vka_object_t reply;
@@ -68,29 +214,70 @@ struct driver_env {
     sel4ps_irq_t timer_irqs[MAX_TIMER_IRQS];
     /* timer callback information */
     timer_callback_info_t timer_cbs[MAX_TIMER_IRQS];
+    /* timeouts of the test processes' timer clients and the watchdogs, and
+     * when the time manager will next wake the wheel up, or UINT64_MAX */
+    timer_wheel_t timer_wheel;
+    uint64_t timer_wheel_wakeup;
+    /* tokens for acknowledging each timer IRQ */
+    sel4test_ack_data_t timer_acks[MAX_TIMER_IRQS];
+    /* with CONFIG_TIMER_LATENCY, the time from the driver seeing a timer IRQ to
+     * its callback returning, and to the test being signalled */
+    latency_hist_t timer_callback_latency;
+    latency_hist_t timer_signal_latency;
 
     /* init data frame vaddr */
     test_init_data_t *init;
+    /* output ring of the test process in the first slot, if CONFIG_LOG_RING is set */
+    log_ring_t *log;
+    /* clock page shared read-only with every test process, if CONFIG_CLOCK_PAGE is set */
+    clock_page_t *clock;
     /* extra cap to the init data frame for mapping into the remote vspace */
     seL4_CPtr init_frame_cap_copy;
 
-    void *remote_vaddr;
-    sel4utils_process_t test_process;
-    seL4_CPtr endpoint;
+    /* test processes, only the first slot is used unless CONFIG_PARALLEL_TESTS is set */
+    test_slot_t slots[MAX_TEST_SLOTS];
+    int num_slots;
+    /* endpoint the slots' badged fault endpoints are minted from */
+    vka_object_t test_endpoint;
 
     int num_untypeds;
     vka_object_t *untypeds;
+    /* CNode with copies of all the untypeds, only used if CONFIG_SHARED_UNTYPED_CNODE is set */
+    vka_object_t untyped_cnode;
+    /* untyped revokes done and skipped because the test never used the untyped */
+    int untyped_revokes;
+    int untyped_revokes_skipped;
 
     /* device frame to use for some tests */
     vka_object_t device_obj;
 
     /* time server for managing timeouts */
     time_manager_t tm;
+
+    /* sel4test-tests images in the CPIO archive */
+    test_image_t images[MAX_TEST_IMAGES];
+    int num_images;
+
+    /* test that is being set up, run and torn down one step at a time */
+    struct testcase *current_test;
 };
 typedef struct driver_env *driver_env_t;
 
 void plat_init(driver_env_t env) WEAK;
 
+/* Test printer functions, implemented in main.c */
+void sel4test_start_test(const char *name, int n);
+void sel4test_end_test(test_result_t result, const test_times_t *times);
+/* Record the memory the test being reported used, see CONFIG_MEMORY_ACCOUNTING */
+void sel4test_record_memory(const test_memory_t *memory);
+
+/* Metadata of a test in sel4test-tests, NULL if it has none. Implemented in main.c */
+const test_metadata_t *sel4test_get_test_metadata(const char *name);
+
+/* Run every selected BASIC test, several at a time. Returns SUCCESS unless the run has to stop early */
+test_result_t basic_run_tests_parallel(driver_env_t env, struct testcase *tests[], int num_tests, int *tests_done,
+                                       int *tests_failed);
+
 #ifdef CONFIG_TK1_SMMU
 seL4_SlotRegion arch_copy_iospace_caps_to_process(sel4utils_process_t *process, driver_env_t env);
 #endif
@@ -24,7 +24,9 @@ static void create_smmu_vspace(driver_env_t env)
 {
     int error;
 
-    sel4utils_process_config_t config = process_config_default_simple(&env->simple, TESTS_APP, env->init->priority);
+    /* any tests image will do, as the process is never started */
+    sel4utils_process_config_t config = process_config_default_simple(&env->simple, env->images[0].name,
+                                                                      env->init->priority);
     config = process_config_mcp(config, seL4_MaxPrio);
     config = process_config_auth(config, simple_get_tcb(&env->simple));
     config = process_config_create_cnode(config, TEST_PROCESS_CSPACE_SIZE_BITS);
@@ -7,10 +7,16 @@
 #include <autoconf.h>
 #include <sel4test-driver/gen_config.h>
 #include <sel4/sel4.h>
+#include <sel4utils/thread.h>
+#include <sel4utils/thread_config.h>
 #include <vka/object.h>
 
+#include "../results.h"
 #include "../timer.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <utils/util.h>
 
 static bool test_finished;
@@ -98,3 +104,251 @@ test_gettime_timeout(driver_env_t env)
 }
 DEFINE_TEST_BOOTSTRAP(TIMER0002, "Test that the timer moves between gettime and timeout calls", test_gettime_timeout,
                       config_set(CONFIG_HAVE_TIMER))
+
+#define WHEEL_TEST_TIMEOUTS 4096
+/* the timeouts are spread over a minute, so that all levels of the wheel are used */
+#define WHEEL_TEST_SPAN (60 * NS_IN_S)
+#define WHEEL_TEST_PERIOD NS_IN_MS
+#define WHEEL_TEST_PERIODS 100
+
+static timer_wheel_t test_wheel;
+static timer_wheel_entry_t test_wheel_entries[WHEEL_TEST_TIMEOUTS];
+
+static struct {
+    /* time the wheel has been expired up to */
+    uint64_t now;
+    int fired;
+    int early;
+    int late;
+    int cancelled;
+} wheel_test;
+
+static int wheel_test_callback(uintptr_t token)
+{
+    timer_wheel_entry_t *entry = &test_wheel_entries[token];
+    wheel_test.fired++;
+    if (entry->period == 0) {
+        if (entry->deadline > wheel_test.now) {
+            wheel_test.early++;
+        } else if (wheel_test.now - entry->deadline >= BIT(TIMER_WHEEL_TICK_BITS)) {
+            wheel_test.late++;
+        }
+    }
+    if (token % 4 == 0) {
+        wheel_test.cancelled++;
+    }
+    return 0;
+}
+
+/* expire the test wheel at each time it asks to be woken up, up to end */
+static void wheel_test_run(uint64_t end)
+{
+    uint64_t next;
+    while (timer_wheel_next(&test_wheel, &next) && next <= end) {
+        test_geq(next, wheel_test.now);
+        wheel_test.now = next;
+        timer_wheel_expire(&test_wheel, next);
+    }
+}
+
+static void report_wheel_cost(const char *name, uint64_t time, int timeouts)
+{
+    const char *units = test_timestamp_units();
+    if (units == NULL) {
+        return;
+    }
+    if (config_set(CONFIG_BINARY_RESULTS)) {
+        result_sample(name, time / timeouts);
+    } else {
+        printf("%s: %llu %s per timeout\n", name, (unsigned long long)(time / timeouts), units);
+    }
+}
+
+int test_timer_wheel(driver_env_t env)
+{
+    uint64_t seed = 1;
+    memset(&wheel_test, 0, sizeof(wheel_test));
+    timer_wheel_init(&test_wheel, 0);
+
+    uint64_t start = test_timestamp(env);
+    for (int i = 0; i < WHEEL_TEST_TIMEOUTS; i++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        timer_wheel_add(&test_wheel, &test_wheel_entries[i], (seed >> 16) % WHEEL_TEST_SPAN, 0,
+                        wheel_test_callback, i);
+    }
+    uint64_t add_time = test_time_elapsed(env, &start);
+
+    /* cancel every fourth timeout */
+    for (int i = 0; i < WHEEL_TEST_TIMEOUTS; i += 4) {
+        timer_wheel_remove(&test_wheel, &test_wheel_entries[i]);
+    }
+    uint64_t remove_time = test_time_elapsed(env, &start);
+    test_eq(test_wheel.count, WHEEL_TEST_TIMEOUTS - WHEEL_TEST_TIMEOUTS / 4);
+
+    wheel_test_run(UINT64_MAX);
+    uint64_t expire_time = test_time_elapsed(env, &start);
+
+    test_eq(wheel_test.fired, WHEEL_TEST_TIMEOUTS - WHEEL_TEST_TIMEOUTS / 4);
+    test_eq(wheel_test.early, 0);
+    test_eq(wheel_test.late, 0);
+    test_eq(wheel_test.cancelled, 0);
+    test_eq(test_wheel.count, 0);
+
+    report_wheel_cost("timer_wheel_add", add_time, WHEEL_TEST_TIMEOUTS);
+    report_wheel_cost("timer_wheel_remove", remove_time, WHEEL_TEST_TIMEOUTS / 4);
+    report_wheel_cost("timer_wheel_expire", expire_time, wheel_test.fired);
+
+    /* a periodic timeout fires once each period */
+    wheel_test.fired = 0;
+    timer_wheel_add(&test_wheel, &test_wheel_entries[1], wheel_test.now + WHEEL_TEST_PERIOD, WHEEL_TEST_PERIOD,
+                    wheel_test_callback, 1);
+    wheel_test_run(wheel_test.now + WHEEL_TEST_PERIODS * WHEEL_TEST_PERIOD + BIT(TIMER_WHEEL_TICK_BITS) - 1);
+    test_eq(wheel_test.fired, WHEEL_TEST_PERIODS);
+    timer_wheel_remove(&test_wheel, &test_wheel_entries[1]);
+    test_check(!timer_wheel_next(&test_wheel, &start));
+
+    return sel4test_get_result();
+}
+DEFINE_TEST_BOOTSTRAP(TIMER0003, "Test the timer wheel with thousands of timeouts", test_timer_wheel, true)
+
+#define LATENCY_SAMPLES 200
+/* the timeouts are set this far ahead, at random */
+#define LATENCY_MIN_OFFSET (50 * NS_IN_US)
+#define LATENCY_MAX_OFFSET (2 * NS_IN_MS)
+
+/* points at which the time past each deadline is measured */
+enum latency_point {
+    /* the driver gets the timer IRQ */
+    LATENCY_IRQ,
+    /* the driver's callback for the timeout runs */
+    LATENCY_CALLBACK,
+    /* a thread waiting on the test timer notification wakes up */
+    LATENCY_WAKEUP,
+    NUM_LATENCY_POINTS
+};
+static const char *latency_point_names[NUM_LATENCY_POINTS] = {"irq", "callback", "wakeup"};
+
+static struct {
+    driver_env_t env;
+    int sample;
+    uint64_t deadline;
+    bool fired;
+    /* signalled by the waiting thread once it has taken its time */
+    vka_object_t done;
+    uint64_t latency[NUM_LATENCY_POINTS][LATENCY_SAMPLES];
+} timer_latency;
+
+static uint64_t since_deadline(uint64_t time)
+{
+    return time > timer_latency.deadline ? time - timer_latency.deadline : 0;
+}
+
+static int latency_callback(UNUSED uintptr_t token)
+{
+    timer_latency.latency[LATENCY_CALLBACK][timer_latency.sample] = since_deadline(timestamp(timer_latency.env));
+    timer_latency.fired = true;
+    /* wake the waiting thread the same way timeouts wake a test */
+    seL4_Signal(timer_latency.env->timer_client_signals[0].capPtr);
+    return 0;
+}
+
+static void latency_waiter(UNUSED void *arg0, UNUSED void *arg1, UNUSED void *ipc_buf)
+{
+    while (true) {
+        seL4_Wait(timer_latency.env->timer_notify_test.cptr, NULL);
+        timer_latency.latency[LATENCY_WAKEUP][timer_latency.sample] = since_deadline(timestamp(timer_latency.env));
+        seL4_Signal(timer_latency.done.cptr);
+    }
+}
+
+static int latency_comparator(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* nearest rank percentile of sorted latencies */
+static uint64_t latency_percentile(const uint64_t *latency, int percent)
+{
+    return latency[(LATENCY_SAMPLES * percent + 99) / 100 - 1];
+}
+
+static void report_latency(enum latency_point point)
+{
+    uint64_t *latency = timer_latency.latency[point];
+    qsort(latency, LATENCY_SAMPLES, sizeof(*latency), latency_comparator);
+    uint64_t p50 = latency_percentile(latency, 50);
+    uint64_t p99 = latency_percentile(latency, 99);
+    uint64_t max = latency[LATENCY_SAMPLES - 1];
+
+    if (config_set(CONFIG_BINARY_RESULTS)) {
+        char name[32];
+        snprintf(name, sizeof(name), "timer_latency_%s_p50", latency_point_names[point]);
+        result_sample(name, p50);
+        snprintf(name, sizeof(name), "timer_latency_%s_p99", latency_point_names[point]);
+        result_sample(name, p99);
+        snprintf(name, sizeof(name), "timer_latency_%s_max", latency_point_names[point]);
+        result_sample(name, max);
+    } else {
+        printf("Timer latency to %s: p50 %llu ns, p99 %llu ns, max %llu ns\n", latency_point_names[point],
+               (unsigned long long) p50, (unsigned long long) p99, (unsigned long long) max);
+    }
+}
+
+int test_timer_latency(driver_env_t env)
+{
+    sel4utils_thread_t waiter;
+    timer_wheel_entry_t timeout = {0};
+    uint64_t seed = 1;
+
+    memset(&timer_latency, 0, sizeof(timer_latency));
+    timer_latency.env = env;
+    int error = vka_alloc_notification(&env->vka, &timer_latency.done);
+    test_assert_fatal(!error);
+
+    /* the waiting thread has the priority of a test process */
+    sel4utils_thread_config_t config = thread_config_default(&env->simple, simple_get_cnode(&env->simple),
+                                                             seL4_NilData, seL4_CapNull, seL4_MaxPrio - 1);
+    error = sel4utils_configure_thread_config(&env->vka, &env->vspace, &env->vspace, config, &waiter);
+    test_assert_fatal(!error);
+    seL4_Poll(env->timer_notify_test.cptr, NULL);
+    error = sel4utils_start_thread(&waiter, latency_waiter, NULL, NULL, true);
+    test_assert_fatal(!error);
+
+    for (int sample = 0; sample < LATENCY_SAMPLES; sample++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        timer_latency.sample = sample;
+        timer_latency.fired = false;
+        timer_latency.deadline = timestamp(env) + LATENCY_MIN_OFFSET +
+                                 (seed >> 16) % (LATENCY_MAX_OFFSET - LATENCY_MIN_OFFSET);
+        timer_wheel_add(&env->timer_wheel, &timeout, timer_latency.deadline, 0, latency_callback, 0);
+        timer_wheel_update(env);
+
+        /* the wheel may wake the driver up before the deadline, so take the
+         * time of the IRQ that fired the timeout */
+        uint64_t irq = 0;
+        while (!timer_latency.fired) {
+            seL4_Word badge;
+            seL4_Wait(env->timer_notification.cptr, &badge);
+            irq = timestamp(env);
+            handle_timer_interrupts(env, badge);
+            timer_update(env);
+        }
+        timer_latency.latency[LATENCY_IRQ][sample] = since_deadline(irq);
+        seL4_Wait(timer_latency.done.cptr, NULL);
+
+        test_leq(timer_latency.latency[LATENCY_IRQ][sample], timer_latency.latency[LATENCY_CALLBACK][sample]);
+        test_leq(timer_latency.latency[LATENCY_CALLBACK][sample], timer_latency.latency[LATENCY_WAKEUP][sample]);
+    }
+
+    sel4utils_clean_up_thread(&env->vka, &env->vspace, &waiter);
+    vka_free_object(&env->vka, &timer_latency.done);
+
+    for (int point = 0; point < NUM_LATENCY_POINTS; point++) {
+        report_latency(point);
+    }
+    return sel4test_get_result();
+}
+DEFINE_TEST_BOOTSTRAP(TIMER0004, "Measure how late timer timeouts wake the driver and tests", test_timer_latency,
+                      config_set(CONFIG_HAVE_TIMER))
@@ -8,11 +8,16 @@
 #include <autoconf.h>
 #include <sel4test-driver/gen_config.h>
 
+#include <regex.h>
+#include <string.h>
+
 #include <sel4debug/register_dump.h>
 #include <vka/capops.h>
 
 #include "test.h"
 #include "timer.h"
+#include "image.h"
+#include "test_timeouts.h"
 #include <sel4rpc/server.h>
 #include <sel4testsupport/testreporter.h>
 
@@ -62,12 +67,82 @@ static seL4_SlotRegion copy_untypeds_to_process(sel4utils_process_t *process, vk
     return range;
 }
 
+/* Create a CNode holding copies of a list of untypeds, so they can be given to a
+ * test process with a single cap. Untyped i is in slot i. */
+static void make_untyped_cnode(driver_env_t env, vka_object_t *untypeds, int num_untypeds, vka_object_t *cnode)
+{
+    seL4_Word size_bits = 1;
+    while (BIT(size_bits) < num_untypeds) {
+        size_bits++;
+    }
+    /* the CNode is a second level CNode in the test process' cspace */
+    ZF_LOGF_IF(size_bits > TEST_PROCESS_CSPACE_L2_BITS, "Too many untypeds for one CNode");
+
+    int error = vka_alloc_cnode_object(&env->vka, size_bits, cnode);
+    ZF_LOGF_IF(error, "Failed to allocate CNode for untypeds");
+
+    for (int i = 0; i < num_untypeds; i++) {
+        cspacepath_t src;
+        vka_cspace_make_path(&env->vka, untypeds[i].cptr, &src);
+        cspacepath_t dest = {
+            .root = cnode->cptr,
+            .capPtr = i,
+            .capDepth = size_bits,
+        };
+        error = vka_cnode_copy(&dest, &src, seL4_AllRights);
+        ZF_LOGF_IF(error, "Failed to copy untyped into CNode");
+    }
+}
+
+/* Create the CNode with all of the untypeds the first time a test type needs it */
+static void init_untyped_cnode(driver_env_t env)
+{
+    if (config_set(CONFIG_SHARED_UNTYPED_CNODE) && env->untyped_cnode.cptr == seL4_CapNull) {
+        make_untyped_cnode(env, env->untypeds, env->num_untypeds, &env->untyped_cnode);
+    }
+}
+
+/* Give a test process the CNode of untypeds in a slot, return the cap range the untypeds can be found in */
+static seL4_SlotRegion share_untyped_cnode(driver_env_t env, test_slot_t *slot)
+{
+    cspacepath_t src;
+    vka_cspace_make_path(&env->vka, slot->untyped_cnode.cptr, &src);
+    cspacepath_t dest = {
+        .root = slot->cspace_root.cptr,
+        .capPtr = TEST_PROCESS_UNTYPED_CNODE_INDEX,
+        .capDepth = TEST_PROCESS_CSPACE_L1_BITS,
+    };
+    /* guard the CNode so that it takes up a whole second level of the cspace */
+    seL4_Word guard_bits = TEST_PROCESS_CSPACE_L2_BITS - slot->untyped_cnode.size_bits;
+    int error = vka_cnode_mint(&dest, &src, seL4_AllRights, api_make_guard_skip_word(guard_bits));
+    ZF_LOGF_IF(error, "Failed to mint untyped CNode into test process");
+
+    seL4_CPtr start = TEST_PROCESS_UNTYPED_CNODE_INDEX << TEST_PROCESS_CSPACE_L2_BITS;
+    return (seL4_SlotRegion) {
+        .start = start,
+        .end = start + slot->untypeds_given - 1,
+    };
+}
+
+/* A test can ask for a timer client that doesn't exist, which fails the test
+ * rather than the driver */
+static bool valid_timer_client(seL4_Word client)
+{
+    if (client >= TIMER_CLIENTS) {
+        ZF_LOGE("Invalid timer client %ld", (long) client);
+        test_check(false);
+        return false;
+    }
+    return true;
+}
+
 static void handle_timer_requests(driver_env_t env, sel4test_output_t test_output)
 {
 
     seL4_MessageInfo_t info;
     uint64_t timeServer_ns;
     seL4_Word timeServer_timeoutType;
+    seL4_Word timeServer_client;
 
     switch (test_output) {
 
@@ -75,8 +150,11 @@ static void handle_timer_requests(driver_env_t env, sel4test_output_t test_outpu
 
         timeServer_timeoutType = seL4_GetMR(1);
         timeServer_ns = sel4utils_64_get_mr(2);
+        timeServer_client = seL4_GetMR(SEL4UTILS_64_WORDS + 2);
 
-        timeout(env, timeServer_ns, timeServer_timeoutType);
+        if (valid_timer_client(timeServer_client)) {
+            timeout(env, timeServer_client, timeServer_ns, timeServer_timeoutType);
+        }
 
         info = seL4_MessageInfo_new(seL4_Fault_NullFault, 0, 0, 1);
 
@@ -93,7 +171,12 @@ static void handle_timer_requests(driver_env_t env, sel4test_output_t test_outpu
         break;
 
     case SEL4TEST_TIME_RESET:
-        timer_reset(env);
+        timeServer_client = seL4_GetMR(1);
+        if (timeServer_client == TIMER_ALL_CLIENTS) {
+            timer_reset(env);
+        } else if (valid_timer_client(timeServer_client)) {
+            timer_reset_client(env, timeServer_client);
+        }
         info = seL4_MessageInfo_new(seL4_Fault_NullFault, 0, 0, 1);
         seL4_SetMR(0, 0);
         api_reply(env->reply.cptr, info);
@@ -106,12 +189,79 @@ static void handle_timer_requests(driver_env_t env, sel4test_output_t test_outpu
 
 }
 
+/* Time budget of a test in ns, or 0 if it can run forever */
+static uint64_t test_timeout_ns(struct testcase *test)
+{
+    if (!config_set(CONFIG_HAVE_TIMER)) {
+        return 0;
+    }
+    for (const struct test_timeout *t = test_timeouts; t->name != NULL; t++) {
+        if (strcmp(t->name, test->name) == 0) {
+            return t->s * NS_IN_S;
+        }
+    }
+    return (uint64_t) CONFIG_TEST_TIMEOUT * NS_IN_S;
+}
+
+/* Find a slot whose test has run out of time */
+static test_slot_t *slot_timed_out(driver_env_t env)
+{
+    for (int i = 0; i < env->num_slots; i++) {
+        if (env->slots[i].test != NULL && env->slots[i].timed_out) {
+            return &env->slots[i];
+        }
+    }
+    return NULL;
+}
+
+/* Stop the timers of a test that has finished */
+static void slot_stop_timers(driver_env_t env, test_slot_t *slot)
+{
+    if (test_timeout_ns(slot->test) != 0) {
+        watchdog_cancel(env, slot - env->slots);
+    }
+    /* only a test that has the machine to itself can use the timer */
+    if (config_set(CONFIG_HAVE_TIMER) && slot->exclusive) {
+        timer_reset(env);
+    }
+}
+
+/* Find the slot a message on the fault endpoint came from */
+static test_slot_t *slot_from_badge(driver_env_t env, seL4_Word badge)
+{
+    for (int i = 0; i < env->num_slots; i++) {
+        if (env->slots[i].test != NULL && env->slots[i].badge == badge) {
+            return &env->slots[i];
+        }
+    }
+
+    ZF_LOGF("Message from unknown test slot, badge %lu", (unsigned long) badge);
+    return NULL;
+}
+
+static size_t print_test_output(void *data, size_t count)
+{
+    printf("%.*s", (int) count, (char *) data);
+    return count;
+}
+
+/* Print the output that the test process in a slot has written to its log ring */
+static void slot_drain_log(test_slot_t *slot)
+{
+    static char scratch[LOG_RING_SIZE];
+    if (config_set(CONFIG_LOG_RING)) {
+        log_ring_drain(slot->log, scratch, print_test_output);
+    }
+}
+
 /* This function waits on:
  * Timer interrupts (from hardware)
  * Requests from tests (sel4driver acts as a server)
  * Results from sel4test/tests
+ *
+ * It returns once any of the running tests finishes, and sets done to its slot.
  */
-static int sel4test_driver_wait(driver_env_t env, struct testcase *test)
+static int sel4test_driver_wait(driver_env_t env, test_slot_t **done)
 {
     seL4_MessageInfo_t info;
     sel4test_output_t test_output;
@@ -122,13 +272,41 @@ static int sel4test_driver_wait(driver_env_t env, struct testcase *test)
     sel4rpc_server_init(&rpc_server, &env->vka, sel4rpc_default_handler, env,
                         &env->reply, &env->simple);
 
+    /* parallel slots all share one endpoint, otherwise there is only the one test process */
+    seL4_CPtr endpoint = env->slots[0].badge ? env->test_endpoint.cptr : env->slots[0].process.fault_endpoint.cptr;
+
     while (1) {
+        /* A watchdog can fire whenever the timer wheel is updated, which also
+         * happens while handling requests and stopping other tests, so check
+         * before waiting again. */
+        test_slot_t *slot = slot_timed_out(env);
+        if (slot != NULL) {
+            /* the test is hung, stop it so that it can be torn down */
+            int error = seL4_TCB_Suspend(slot->process.thread.tcb.cptr);
+            ZF_LOGF_IF(error, "Failed to suspend test process");
+            slot->waiting = false;
+            slot_stop_timers(env, slot);
+            *done = slot;
+            return TIMEOUT;
+        }
+
         /* wait for tests to finish or fault, receive test request or report result */
-        info = api_recv(env->test_process.fault_endpoint.cptr, &badge, env->reply.cptr);
+        info = api_recv(endpoint, &badge, env->reply.cptr);
         test_output = seL4_GetMR(0);
 
+        /* Catch up on the output of the running tests. When quiet, the output
+         * is only wanted once the test has finished and been reported. */
+        if (!QUIET_OUTPUT) {
+            for (int i = 0; i < env->num_slots; i++) {
+                if (env->slots[i].test != NULL) {
+                    slot_drain_log(&env->slots[i]);
+                }
+            }
+        }
+
         /* FIXME: Assumptions made at the time of writing this code:
-         * 1) fault sync EP cap has a badge of 0
+         * 1) fault sync EP caps have a badge of 0, or TEST_SLOT_BADGE when running
+         * tests in parallel, which never overlaps the timer badge bits.
          * 2) notification_cap bound to sel4test-driver TCB, and has a non zero badge.
          * 3) sel4test-driver only sets up and expects timer interrupts. If, in the
          * future, other types of interrupts are to be handled, the following code would
@@ -137,21 +315,23 @@ static int sel4test_driver_wait(driver_env_t env, struct testcase *test)
          * For now, assume it is a timer interrupt, handle it and signal any test processes
          * that might be waiting on it.
          */
-        if (badge != 0) {
+        seL4_Word irq_badge = badge & MASK(MAX_TIMER_IRQS);
+        if (irq_badge != 0) {
             assert(config_set(CONFIG_HAVE_TIMER));
         }
 
-        if (config_set(CONFIG_HAVE_TIMER) && badge != 0) {
+        if (config_set(CONFIG_HAVE_TIMER) && irq_badge != 0) {
             /* handle timer interrupts in hardware */
-            handle_timer_interrupts(env, badge);
+            handle_timer_interrupts(env, irq_badge);
             /* Driver does extra work to check whether timeout succeeded and signals
              * clients/tests
              */
-            int error = tm_update(&env->tm);
-            ZF_LOGF_IF(error, "Failed to update time manager");
+            timer_update(env);
             continue;
         }
 
+        slot = slot_from_badge(env, badge);
+
         if (sel4test_isTimerRPC(test_output)) {
 
             if (config_set(CONFIG_HAVE_TIMER)) {
@@ -168,132 +348,456 @@ static int sel4test_driver_wait(driver_env_t env, struct testcase *test)
 
         result = test_output;
         if (seL4_MessageInfo_get_label(info) != seL4_Fault_NullFault) {
-            sel4utils_print_fault_message(info, test->name);
+            sel4utils_print_fault_message(info, slot->test->name);
             printf("Register of root thread in test (may not be the thread that faulted)\n");
-            sel4debug_dump_registers(env->test_process.thread.tcb.cptr);
+            sel4debug_dump_registers(slot->process.thread.tcb.cptr);
             result = FAILURE;
         }
 
-        if (config_set(CONFIG_HAVE_TIMER)) {
-            timer_cleanup(env);
-        }
+        slot->waiting = seL4_MessageInfo_get_label(info) == seL4_Fault_NullFault &&
+                        seL4_MessageInfo_get_length(info) > 1 && seL4_GetMR(1) == TEST_PROCESS_WAITING;
+        slot_stop_timers(env, slot);
 
+        *done = slot;
         return result;
     }
 }
 
-void basic_set_up(uintptr_t e)
+/* Put the CNode of a new test process under a new root CNode, so that the
+ * process can add more CNodes to its cspace. All existing cptrs in the process
+ * still refer to the same slots. */
+static void slot_make_two_level_cspace(driver_env_t env, test_slot_t *slot)
+{
+    sel4utils_process_t *process = &slot->process;
+    seL4_Word guard_bits = seL4_WordBits - TEST_PROCESS_CSPACE_L1_BITS - TEST_PROCESS_CSPACE_L2_BITS;
+
+    int error = vka_alloc_cnode_object(&env->vka, TEST_PROCESS_CSPACE_L1_BITS, &slot->cspace_root);
+    ZF_LOGF_IF(error, "Failed to allocate root CNode");
+
+    /* the process' CNode goes in the first slot of the root */
+    cspacepath_t src, dest;
+    vka_cspace_make_path(&env->vka, process->cspace.cptr, &src);
+    dest = (cspacepath_t) {
+        .root = slot->cspace_root.cptr,
+        .capPtr = 0,
+        .capDepth = TEST_PROCESS_CSPACE_L1_BITS,
+    };
+    error = vka_cnode_mint(&dest, &src, seL4_AllRights, api_make_guard_skip_word(0));
+    ZF_LOGF_IF(error, "Failed to mint CNode into root CNode");
+
+    /* replace the process' cap to its own CNode with one to the root */
+    vka_cspace_make_path(&env->vka, slot->cspace_root.cptr, &src);
+    dest = (cspacepath_t) {
+        .root = process->cspace.cptr,
+        .capPtr = SEL4UTILS_CNODE_SLOT,
+        .capDepth = process->cspace_size,
+    };
+    error = vka_cnode_delete(&dest);
+    ZF_LOGF_IF(error, "Failed to delete CNode cap of test process");
+    error = vka_cnode_mint(&dest, &src, seL4_AllRights, api_make_guard_skip_word(guard_bits));
+    ZF_LOGF_IF(error, "Failed to mint root CNode into test process");
+
+#ifdef CONFIG_KERNEL_MCS
+    seL4_CPtr fault_ep = process->fault_endpoint.cptr;
+#else
+    seL4_CPtr fault_ep = SEL4UTILS_ENDPOINT_SLOT;
+#endif
+    error = seL4_TCB_SetSpace(process->thread.tcb.cptr, fault_ep, slot->cspace_root.cptr,
+                              api_make_guard_skip_word(guard_bits), process->pd.cptr, seL4_NilData);
+    ZF_LOGF_IF(error, "Failed to set cspace of test process");
+}
+
+/* Number of a slot's untypeds, largest first, that cover the untyped memory a
+ * test says it needs. A test that doesn't say gets all of them. */
+static int slot_untypeds_needed(test_slot_t *slot, struct testcase *test)
+{
+    /* a reused process has to have enough memory for any test */
+    if (config_set(CONFIG_REUSE_TEST_PROCESS) && test->test_type == STATELESS) {
+        return slot->num_untypeds;
+    }
+    const test_metadata_t *metadata = sel4test_get_test_metadata(test->name);
+    if (metadata == NULL || metadata->untyped_bytes == 0) {
+        return slot->num_untypeds;
+    }
+
+    uint64_t bytes = 0;
+    int i;
+    for (i = 0; i < slot->num_untypeds && bytes < metadata->untyped_bytes; i++) {
+        bytes += BIT(slot->untypeds[i].size_bits);
+    }
+    return i;
+}
+
+/* Create a test process in a slot, from the image with the test it will run */
+static void slot_set_up(driver_env_t env, test_slot_t *slot, struct testcase *test)
 {
     int error;
-    driver_env_t env = (driver_env_t)e;
+    test_init_data_t *init = slot->init;
+    sel4utils_process_t *process = &slot->process;
+
+    if (init != env->init) {
+        /* start from the init data that is common to all tests */
+        memcpy(init, env->init, sizeof(test_init_data_t));
+    }
+    slot->image = image_of_test(env, test);
+    ZF_LOGF_IF(slot->image == NULL, "Test %s isn't in a "TESTS_APP" image", test->name);
+    /* the region list is for the process to clone itself */
+    memcpy(init->elf_regions, slot->image->elf_regions, sizeof(sel4utils_elf_region_t) * slot->image->num_elf_regions);
+    init->num_elf_regions = slot->image->num_elf_regions;
 
-    sel4utils_process_config_t config = process_config_default_simple(&env->simple, TESTS_APP, env->init->priority);
+    slot->untypeds_given = slot_untypeds_needed(slot, test);
+    for (int i = 0; i < slot->untypeds_given; i++) {
+        init->untyped_size_bits_list[i] = slot->untypeds[i].size_bits;
+    }
+    init->untypeds_used = 0;
+
+    sel4utils_process_config_t config = process_config_default_simple(&env->simple, slot->image->name,
+                                                                      init->priority);
     config = process_config_mcp(config, seL4_MaxPrio);
     config = process_config_auth(config, simple_get_tcb(&env->simple));
-    config = process_config_create_cnode(config, TEST_PROCESS_CSPACE_SIZE_BITS);
-    error = sel4utils_configure_process_custom(&(env->test_process), &env->vka, &env->vspace, config);
+    if (config_set(CONFIG_TWO_LEVEL_CSPACE)) {
+        config = process_config_create_cnode(config, TEST_PROCESS_CSPACE_L2_BITS);
+    } else {
+        config = process_config_create_cnode(config, TEST_PROCESS_CSPACE_SIZE_BITS);
+    }
+    if (slot->badge) {
+        config = process_config_fault_endpoint(config, slot->fault_endpoint);
+    }
+    if (config_set(CONFIG_PROCESS_TEMPLATE)) {
+        config = image_process_config(slot->image, slot->image_regions, config);
+    }
+    error = sel4utils_configure_process_custom(process, &env->vka, &env->vspace, config);
     assert(error == 0);
+    if (config_set(CONFIG_PROCESS_TEMPLATE)) {
+        image_load(env, slot->image, slot->image_regions, process);
+    }
+    if (config_set(CONFIG_TWO_LEVEL_CSPACE)) {
+        slot_make_two_level_cspace(env, slot);
+    }
 
     /* set up caps about the process */
-    env->init->stack_pages = CONFIG_SEL4UTILS_STACK_SIZE / PAGE_SIZE_4K;
-    env->init->stack = env->test_process.thread.stack_top - CONFIG_SEL4UTILS_STACK_SIZE;
-    env->init->page_directory = sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, env->test_process.pd.cptr);
-    env->init->root_cnode = SEL4UTILS_CNODE_SLOT;
-    env->init->tcb = sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, env->test_process.thread.tcb.cptr);
+    init->stack_pages = CONFIG_SEL4UTILS_STACK_SIZE / PAGE_SIZE_4K;
+    init->stack = process->thread.stack_top - CONFIG_SEL4UTILS_STACK_SIZE;
+    init->page_directory = sel4utils_copy_cap_to_process(process, &env->vka, process->pd.cptr);
+    init->root_cnode = SEL4UTILS_CNODE_SLOT;
+    init->tcb = sel4utils_copy_cap_to_process(process, &env->vka, process->thread.tcb.cptr);
     if (config_set(CONFIG_HAVE_TIMER)) {
-        env->init->timer_ntfn = sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, env->timer_notify_test.cptr);
+        init->timer_ntfn = sel4utils_copy_cap_to_process(process, &env->vka, env->timer_notify_test.cptr);
+        init->timer_client_ntfns[0] = init->timer_ntfn;
+        for (int i = 1; i < TIMER_CLIENTS; i++) {
+            init->timer_client_ntfns[i] = sel4utils_copy_cap_to_process(process, &env->vka,
+                                                                        env->timer_client_ntfns[i].cptr);
+        }
     }
 
-    env->init->domain = sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, simple_get_init_cap(&env->simple,
-                                                                                                           seL4_CapDomain));
-    env->init->asid_pool = sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, simple_get_init_cap(&env->simple,
-                                                                                                              seL4_CapInitThreadASIDPool));
-    env->init->asid_ctrl = sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, simple_get_init_cap(&env->simple,
-                                                                                                              seL4_CapASIDControl));
+    init->domain = sel4utils_copy_cap_to_process(process, &env->vka, simple_get_init_cap(&env->simple,
+                                                                                          seL4_CapDomain));
+    init->asid_pool = sel4utils_copy_cap_to_process(process, &env->vka, simple_get_init_cap(&env->simple,
+                                                                                             seL4_CapInitThreadASIDPool));
+    init->asid_ctrl = sel4utils_copy_cap_to_process(process, &env->vka, simple_get_init_cap(&env->simple,
+                                                                                             seL4_CapASIDControl));
 #ifdef CONFIG_IOMMU
-    env->init->io_space = sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, simple_get_init_cap(&env->simple,
-                                                                                                             seL4_CapIOSpace));
+    init->io_space = sel4utils_copy_cap_to_process(process, &env->vka, simple_get_init_cap(&env->simple,
+                                                                                            seL4_CapIOSpace));
 #endif /* CONFIG_IOMMU */
 #ifdef CONFIG_TK1_SMMU
-    env->init->io_space_caps = arch_copy_iospace_caps_to_process(&(env->test_process), &env);
+    init->io_space_caps = arch_copy_iospace_caps_to_process(process, env);
 #endif
-    env->init->cores = simple_get_core_count(&env->simple);
-    /* copy the sched ctrl caps to the remote process */
+    init->cores = simple_get_core_count(&env->simple);
+    /* copy the sched ctrl caps to the remote process, starting from the slot's own core
+     * so that the test's core 0 is the core it is pinned to */
     if (config_set(CONFIG_KERNEL_MCS)) {
-        seL4_CPtr sched_ctrl = simple_get_sched_ctrl(&env->simple, 0);
-        env->init->sched_ctrl = sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, sched_ctrl);
-        for (int i = 1; i < env->init->cores; i++) {
-            sched_ctrl = simple_get_sched_ctrl(&env->simple, i);
-            sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, sched_ctrl);
+        for (int i = 0; i < init->cores; i++) {
+            seL4_CPtr sched_ctrl = simple_get_sched_ctrl(&env->simple, (slot->core + i) % init->cores);
+            seL4_CPtr cap = sel4utils_copy_cap_to_process(process, &env->vka, sched_ctrl);
+            if (i == 0) {
+                init->sched_ctrl = cap;
+            }
         }
     }
 #ifdef CONFIG_ALLOW_SMC_CALLS
-    env->init->smc = sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, simple_get_init_cap(&env->simple,
-                                                                                                        seL4_CapSMC));
+    init->smc = sel4utils_copy_cap_to_process(process, &env->vka, simple_get_init_cap(&env->simple, seL4_CapSMC));
 #endif /* CONFIG_ALLOW_SMC_CALLS */
 
     /* setup data about untypeds */
-    env->init->untypeds = copy_untypeds_to_process(&(env->test_process), env->untypeds, env->num_untypeds, env);
+    if (config_set(CONFIG_SHARED_UNTYPED_CNODE)) {
+        init->untypeds = share_untyped_cnode(env, slot);
+    } else {
+        init->untypeds = copy_untypeds_to_process(process, slot->untypeds, slot->untypeds_given, env);
+    }
     /* copy the fault endpoint - we wait on the endpoint for a message
      * or a fault to see when the test finishes */
-    env->endpoint = sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, env->test_process.fault_endpoint.cptr);
+    slot->endpoint = sel4utils_copy_cap_to_process(process, &env->vka, process->fault_endpoint.cptr);
 
     /* copy the device frame, if any */
-    if (env->init->device_frame_cap) {
-        env->init->device_frame_cap = sel4utils_copy_cap_to_process(&(env->test_process), &env->vka, env->device_obj.cptr);
+    if (init->device_frame_cap) {
+        init->device_frame_cap = sel4utils_copy_cap_to_process(process, &env->vka, env->device_obj.cptr);
     }
 
     /* map the cap into remote vspace */
-    env->remote_vaddr = vspace_share_mem(&env->vspace, &(env->test_process).vspace, env->init, 1, PAGE_BITS_4K,
-                                         seL4_AllRights, 1);
-    assert(env->remote_vaddr != 0);
+    slot->remote_vaddr = vspace_share_mem(&env->vspace, &process->vspace, init, 1, PAGE_BITS_4K,
+                                          seL4_AllRights, 1);
+    assert(slot->remote_vaddr != 0);
+
+    /* and the ring it writes its output to */
+    if (config_set(CONFIG_LOG_RING)) {
+        log_ring_reset(slot->log);
+        slot->remote_log = vspace_share_mem(&env->vspace, &process->vspace, slot->log, LOG_RING_PAGES,
+                                            PAGE_BITS_4K, seL4_AllRights, 1);
+        ZF_LOGF_IF(slot->remote_log == NULL, "Failed to map log ring into test process");
+        init->log_ring = slot->remote_log;
+    }
+
+    /* and the clock page, which only the driver writes to */
+    if (config_set(CONFIG_CLOCK_PAGE)) {
+        slot->remote_clock = vspace_share_mem(&env->vspace, &process->vspace, env->clock, 1, PAGE_BITS_4K,
+                                              seL4_CanRead, 1);
+        ZF_LOGF_IF(slot->remote_clock == NULL, "Failed to map clock page into test process");
+        init->clock_page = slot->remote_clock;
+    }
 
     /* WARNING: DO NOT COPY MORE CAPS TO THE PROCESS BEYOND THIS POINT,
      * AS THE SLOTS WILL BE CONSIDERED FREE AND OVERRIDDEN BY THE TEST PROCESS. */
     /* set up free slot range */
-    env->init->cspace_size_bits = TEST_PROCESS_CSPACE_SIZE_BITS;
-    if (env->init->device_frame_cap) {
-        env->init->free_slots.start = env->init->device_frame_cap + 1;
+    if (config_set(CONFIG_TWO_LEVEL_CSPACE)) {
+        /* the free slots are the rest of the first second level CNode */
+        init->cspace_size_bits = TEST_PROCESS_CSPACE_L1_BITS + TEST_PROCESS_CSPACE_L2_BITS;
+        init->free_slots.end = BIT(TEST_PROCESS_CSPACE_L2_BITS);
     } else {
-        env->init->free_slots.start = env->endpoint + 1;
+        init->cspace_size_bits = TEST_PROCESS_CSPACE_SIZE_BITS;
+        init->free_slots.end = (1u << TEST_PROCESS_CSPACE_SIZE_BITS);
     }
-    env->init->free_slots.end = (1u << TEST_PROCESS_CSPACE_SIZE_BITS);
-    assert(env->init->free_slots.start < env->init->free_slots.end);
+    if (init->device_frame_cap) {
+        init->free_slots.start = init->device_frame_cap + 1;
+    } else {
+        init->free_slots.start = slot->endpoint + 1;
+    }
+    assert(init->free_slots.start < init->free_slots.end);
 }
 
-test_result_t basic_run_test(struct testcase *test, uintptr_t e)
+/* Give the test process in a slot the next test to run */
+static void slot_assign_test(driver_env_t env, test_slot_t *slot, struct testcase *test)
 {
-    int error;
-    driver_env_t env = (driver_env_t)e;
-
     /* copy test name */
-    strncpy(env->init->name, test->name, TEST_NAME_MAX);
+    strncpy(slot->init->name, test->name, TEST_NAME_MAX);
     /* ensure string is null terminated */
-    env->init->name[TEST_NAME_MAX - 1] = '\0';
+    slot->init->name[TEST_NAME_MAX - 1] = '\0';
 #ifdef CONFIG_DEBUG_BUILD
-    seL4_DebugNameThread(env->test_process.thread.tcb.cptr, env->init->name);
+    seL4_DebugNameThread(slot->process.thread.tcb.cptr, slot->init->name);
 #endif
+    slot->test = test;
+
+    if (config_set(CONFIG_HAVE_TIMER) && slot->exclusive) {
+        /* Correct any drift between the counter and the timer. Tests sharing
+         * the machine could see time go backwards, so only do it when there
+         * aren't any. */
+        if (config_set(CONFIG_CLOCK_PAGE)) {
+            clock_page_update(env);
+        }
+    }
+
+    slot->timed_out = false;
+    uint64_t budget = test_timeout_ns(test);
+    if (budget != 0) {
+        watchdog_start(env, slot - env->slots, budget, &slot->timed_out);
+    }
+}
+
+/* Start a test in a slot that has been set up */
+static void slot_start(driver_env_t env, test_slot_t *slot, struct testcase *test)
+{
+    int error;
+    sel4utils_process_t *process = &slot->process;
+
+    slot_assign_test(env, slot, test);
 
     /* set up args for the test process */
     seL4_Word argc = 2;
     char string_args[argc][WORD_STRING_SIZE];
     char *argv[argc];
-    sel4utils_create_word_args(string_args, argv, argc, env->endpoint, env->remote_vaddr);
+    sel4utils_create_word_args(string_args, argv, argc, slot->endpoint, slot->remote_vaddr);
+
+    /* pin the test to the slot's core */
+    if (env->num_slots > 1) {
+#ifdef CONFIG_KERNEL_MCS
+        seL4_Time timeslice = CONFIG_BOOT_THREAD_TIME_SLICE * US_IN_MS;
+        error = api_sched_ctrl_configure(simple_get_sched_ctrl(&env->simple, slot->core),
+                                         process->thread.sched_context.cptr, timeslice, timeslice, 0, 0);
+        ZF_LOGF_IF(error, "Failed to configure scheduling context");
+#elif CONFIG_MAX_NUM_NODES > 1
+        error = seL4_TCB_SetAffinity(process->thread.tcb.cptr, slot->core);
+        ZF_LOGF_IF(error, "Failed to set tcb affinity");
+#endif
+    }
 
     /* spawn the process */
-    error = sel4utils_spawn_process_v(&(env->test_process), &env->vka, &env->vspace,
-                                      argc, argv, 1);
+    error = sel4utils_spawn_process_v(process, &env->vka, &env->vspace, argc, argv, 1);
     ZF_LOGF_IF(error != 0, "Failed to start test process!");
+}
 
-    if (config_set(CONFIG_HAVE_TIMER)) {
-        error = tm_alloc_id_at(&env->tm, TIMER_ID);
-        ZF_LOGF_IF(error != 0, "Failed to alloc time id %d", TIMER_ID);
+/* Report the memory the test in a slot used with the test being reported. Only
+ * call this when tearing down the test that is being reported. */
+static void slot_record_memory(test_slot_t *slot)
+{
+    if (config_set(CONFIG_MEMORY_ACCOUNTING)) {
+        sel4test_record_memory(&slot->init->memory);
+    }
+}
+
+/* Reset the untypeds the test in a slot used, ready for the next test */
+static void slot_revoke_untypeds(driver_env_t env, test_slot_t *slot)
+{
+    /* The rest were never handed to the test's allocator, so they can't have any children */
+    int used = MIN(slot->init->untypeds_used, (seL4_Word) slot->untypeds_given);
+    for (int i = 0; i < used; i++) {
+        cspacepath_t path;
+        if (config_set(CONFIG_SHARED_UNTYPED_CNODE)) {
+            /* the test used the copy in the CNode */
+            path = (cspacepath_t) {
+                .root = slot->untyped_cnode.cptr,
+                .capPtr = i,
+                .capDepth = slot->untyped_cnode.size_bits,
+            };
+        } else {
+            vka_cspace_make_path(&env->vka, slot->untypeds[i].cptr, &path);
+        }
+        vka_cnode_revoke(&path);
     }
+    env->untyped_revokes += used;
+    env->untyped_revokes_skipped += slot->untypeds_given - used;
+    slot->init->untypeds_used = 0;
+}
+
+/* Destroy the test process in a slot and reclaim everything it was given */
+static void slot_tear_down(driver_env_t env, test_slot_t *slot)
+{
+    /* unmap the init data frame */
+    vspace_unmap_pages(&slot->process.vspace, slot->remote_vaddr, 1, PAGE_BITS_4K, NULL);
+
+    /* print the rest of the test's output and unmap its log ring */
+    if (config_set(CONFIG_LOG_RING)) {
+        slot_drain_log(slot);
+        vspace_unmap_pages(&slot->process.vspace, slot->remote_log, LOG_RING_PAGES, PAGE_BITS_4K, NULL);
+    }
+    if (config_set(CONFIG_CLOCK_PAGE)) {
+        vspace_unmap_pages(&slot->process.vspace, slot->remote_clock, 1, PAGE_BITS_4K, NULL);
+    }
+
+    slot_revoke_untypeds(env, slot);
+
+    /* destroy the process */
+    if (config_set(CONFIG_PROCESS_TEMPLATE)) {
+        image_unload(slot->image, slot->image_regions, &slot->process);
+    }
+    if (slot->badge) {
+        /* the fault endpoint belongs to the slot, not the process */
+        slot->process.fault_endpoint.cptr = 0;
+    }
+    if (config_set(CONFIG_TWO_LEVEL_CSPACE)) {
+        /* Remove the copies of the root CNode cap first, as the process' CNode holds
+         * one of them. Any second level CNodes the test added came from its untypeds,
+         * so they are already gone. */
+        cspacepath_t path;
+        vka_cspace_make_path(&env->vka, slot->cspace_root.cptr, &path);
+        vka_cnode_revoke(&path);
+        vka_free_object(&env->vka, &slot->cspace_root);
+    }
+    sel4utils_destroy_process(&slot->process, &env->vka);
+    slot->test = NULL;
+}
+
+/* untyped pools for each slot when running tests in parallel */
+static vka_object_t slot_untypeds[MAX_TEST_SLOTS][CONFIG_MAX_NUM_BOOTINFO_UNTYPED_CAPS];
+static int slot_num_untypeds[MAX_TEST_SLOTS];
+static vka_object_t slot_untyped_cnodes[MAX_TEST_SLOTS];
+
+static void basic_set_up_test_type(uintptr_t e)
+{
+    driver_env_t env = (driver_env_t)e;
+    int error;
+
+    init_untyped_cnode(env);
+
+    /* by default, a single test process with all of the untypeds runs on the boot core */
+    env->num_slots = 1;
+    env->slots[0] = (test_slot_t) {
+        .exclusive = true,
+        .init = env->init,
+        .log = env->log,
+        .num_untypeds = env->num_untypeds,
+        .untypeds = env->untypeds,
+        .untyped_cnode = env->untyped_cnode,
+    };
+
+    if (!config_set(CONFIG_PARALLEL_TESTS)) {
+        return;
+    }
+
+    env->num_slots = MIN(MIN(simple_get_core_count(&env->simple), MAX_TEST_SLOTS), env->num_untypeds);
+    if (env->num_slots <= 1) {
+        env->num_slots = 1;
+        return;
+    }
+
+    error = vka_alloc_endpoint(&env->vka, &env->test_endpoint);
+    ZF_LOGF_IF(error, "Failed to allocate test endpoint");
+    cspacepath_t src;
+    vka_cspace_make_path(&env->vka, env->test_endpoint.cptr, &src);
+
+    for (int i = 0; i < env->num_slots; i++) {
+        test_slot_t *slot = &env->slots[i];
+        cspacepath_t dest;
+
+        slot->core = i;
+        slot->badge = TEST_SLOT_BADGE(i);
+        error = vka_cspace_alloc_path(&env->vka, &dest);
+        ZF_LOGF_IF(error, "Failed to allocate slot for badged endpoint");
+        error = vka_cnode_mint(&dest, &src, seL4_AllRights, slot->badge);
+        ZF_LOGF_IF(error, "Failed to mint badged endpoint");
+        slot->fault_endpoint.cptr = dest.capPtr;
+
+        slot->init = (test_init_data_t *) vspace_new_pages(&env->vspace, seL4_AllRights, 1, PAGE_BITS_4K);
+        ZF_LOGF_IF(slot->init == NULL, "Failed to allocate init data frame");
+        if (config_set(CONFIG_LOG_RING)) {
+            slot->log = (log_ring_t *) vspace_new_pages(&env->vspace, seL4_AllRights, LOG_RING_PAGES,
+                                                        PAGE_BITS_4K);
+            ZF_LOGF_IF(slot->log == NULL, "Failed to allocate log ring");
+        }
+    }
+
+    /* deal the untypeds out like cards. They are sorted by size, so each slot
+     * ends up with a similar amount of memory */
+    for (int i = 0; i < env->num_untypeds; i++) {
+        int s = i % env->num_slots;
+        slot_untypeds[s][slot_num_untypeds[s]] = env->untypeds[i];
+        slot_num_untypeds[s]++;
+    }
+    if (config_set(CONFIG_SHARED_UNTYPED_CNODE)) {
+        for (int s = 0; s < env->num_slots; s++) {
+            make_untyped_cnode(env, slot_untypeds[s], slot_num_untypeds[s], &slot_untyped_cnodes[s]);
+        }
+    }
+}
+
+void basic_set_up(uintptr_t e)
+{
+    driver_env_t env = (driver_env_t)e;
+    slot_set_up(env, &env->slots[0], env->current_test);
+}
+
+test_result_t basic_run_test(struct testcase *test, uintptr_t e)
+{
+    driver_env_t env = (driver_env_t)e;
+    test_slot_t *slot = NULL;
+
+    slot_start(env, &env->slots[0], test);
 
     /* wait on it to finish or fault, report result */
-    int result = sel4test_driver_wait(env, test);
+    int result = sel4test_driver_wait(env, &slot);
+    assert(slot == &env->slots[0]);
 
-    test_assert(result == SUCCESS);
+    /* a timeout is reported when the test ends */
+    test_assert(result == SUCCESS || result == TIMEOUT);
 
     return result;
 }
@@ -301,19 +805,252 @@ test_result_t basic_run_test(struct testcase *test, uintptr_t e)
 void basic_tear_down(uintptr_t e)
 {
     driver_env_t env = (driver_env_t)e;
-    /* unmap the env->init data frame */
-    vspace_unmap_pages(&(env->test_process).vspace, env->remote_vaddr, 1, PAGE_BITS_4K, NULL);
+    slot_record_memory(&env->slots[0]);
+    slot_tear_down(env, &env->slots[0]);
+}
 
-    /* reset all the untypeds for the next test */
-    for (int i = 0; i < env->num_untypeds; i++) {
-        cspacepath_t path;
-        vka_cspace_make_path(&env->vka, env->untypeds[i].cptr, &path);
-        vka_cnode_revoke(&path);
+DEFINE_TEST_TYPE(BASIC, BASIC, basic_set_up_test_type, NULL, basic_set_up, basic_tear_down, basic_run_test);
+
+/* Stateless test type. With CONFIG_REUSE_TEST_PROCESS the tests run one after
+ * another in the same test process, which waits for the next test once it has
+ * reported its result. */
+/* whether the test process in the first slot is waiting for another test */
+static bool worker_running;
+/* number of tests run by the current test process */
+static int worker_tests;
+
+static void stateless_set_up_test_type(uintptr_t e)
+{
+    driver_env_t env = (driver_env_t)e;
+
+    init_untyped_cnode(env);
+
+    /* a single test process with all of the untypeds */
+    env->num_slots = 1;
+    env->slots[0] = (test_slot_t) {
+        .exclusive = true,
+        .init = env->init,
+        .log = env->log,
+        .num_untypeds = env->num_untypeds,
+        .untypeds = env->untypeds,
+        .untyped_cnode = env->untyped_cnode,
+    };
+    worker_running = false;
+}
+
+static void stateless_tear_down_test_type(uintptr_t e)
+{
+    driver_env_t env = (driver_env_t)e;
+    if (worker_running) {
+        slot_tear_down(env, &env->slots[0]);
+        worker_running = false;
     }
+}
 
-    /* destroy the process */
-    sel4utils_destroy_process(&(env->test_process), &env->vka);
+static void stateless_set_up(uintptr_t e)
+{
+    driver_env_t env = (driver_env_t)e;
+    if (worker_running && env->slots[0].image != image_of_test(env, env->current_test)) {
+        /* the waiting process doesn't have this test in its image */
+        slot_tear_down(env, &env->slots[0]);
+        worker_running = false;
+    }
+    if (!worker_running) {
+        slot_set_up(env, &env->slots[0], env->current_test);
+    }
+}
+
+/* Run a test in the test process, starting a new one if there isn't one waiting */
+static int stateless_run_in_worker(driver_env_t env, struct testcase *test)
+{
+    test_slot_t *slot = &env->slots[0];
+
+    if (worker_running) {
+        slot_assign_test(env, slot, test);
+        /* wake the test process up to run the test */
+        seL4_MessageInfo_t info = seL4_MessageInfo_new(seL4_Fault_NullFault, 0, 0, 1);
+        seL4_SetMR(0, 0);
+        api_reply(env->reply.cptr, info);
+    } else {
+        slot_start(env, slot, test);
+        worker_running = true;
+        worker_tests = 0;
+    }
+    worker_tests++;
+
+    int result = sel4test_driver_wait(env, &slot);
+    assert(slot == &env->slots[0]);
+    slot_drain_log(slot);
+    if (!slot->waiting) {
+        /* the test process faulted or aborted, so it can't be reused */
+        slot_record_memory(slot);
+        slot_tear_down(env, slot);
+        worker_running = false;
+    }
+
+    return result;
 }
 
-DEFINE_TEST_TYPE(BASIC, BASIC, NULL, NULL, basic_set_up, basic_tear_down, basic_run_test);
+static test_result_t stateless_run_test(struct testcase *test, uintptr_t e)
+{
+    driver_env_t env = (driver_env_t)e;
+
+    int result = stateless_run_in_worker(env, test);
+    if (!worker_running && worker_tests > 1 && result != TIMEOUT) {
+        /* an earlier test may have left something behind that caused this, so
+         * run the test again in a fresh process before reporting it. Hung tests
+         * aren't run again, as that would cost a second time budget. */
+        printf("Test %s died after %d tests in the same process, running it again in a new process\n",
+               test->name, worker_tests - 1);
+        slot_set_up(env, &env->slots[0], test);
+        result = stateless_run_in_worker(env, test);
+    }
+
+    /* a timeout is reported when the test ends */
+    test_assert(result == SUCCESS || result == TIMEOUT);
+
+    return result;
+}
+
+static void stateless_tear_down(uintptr_t e)
+{
+    driver_env_t env = (driver_env_t)e;
+    test_slot_t *slot = &env->slots[0];
+
+    if (!worker_running) {
+        return;
+    }
+    slot_record_memory(slot);
+    if (config_set(CONFIG_REUSE_TEST_PROCESS)) {
+        /* the test process has already deleted the caps it made, so only the
+         * untypeds are left to clean up before it runs another test */
+        slot_revoke_untypeds(env, slot);
+    } else {
+        slot_tear_down(env, slot);
+        worker_running = false;
+    }
+}
+
+static DEFINE_TEST_TYPE(STATELESS, STATELESS, stateless_set_up_test_type, stateless_tear_down_test_type,
+                        stateless_set_up, stateless_tear_down, stateless_run_test);
+
+static test_slot_t *free_slot(driver_env_t env)
+{
+    for (int i = 0; i < env->num_slots; i++) {
+        if (env->slots[i].test == NULL) {
+            return &env->slots[i];
+        }
+    }
+    return NULL;
+}
 
+/* Whether a test's metadata says it can't share the machine with other tests */
+static bool test_needs_machine(struct testcase *test)
+{
+    const test_metadata_t *metadata = sel4test_get_test_metadata(test->name);
+    return metadata != NULL && (metadata->exclusive || metadata->needs_timer || metadata->cores > 1);
+}
+
+/* Expected run time of a test from its metadata, 0 if it isn't known */
+static uint64_t test_runtime(struct testcase *test)
+{
+    const test_metadata_t *metadata = sel4test_get_test_metadata(test->name);
+    return metadata != NULL ? metadata->runtime_us : 0;
+}
+
+/* Sort tests longest first, keeping tests with the same run time in name order */
+static int test_runtime_comparator(const void *a, const void *b)
+{
+    struct testcase *ta = *(struct testcase * const *) a;
+    struct testcase *tb = *(struct testcase * const *) b;
+    uint64_t ra = test_runtime(ta);
+    uint64_t rb = test_runtime(tb);
+    if (ra != rb) {
+        return ra < rb ? 1 : -1;
+    }
+    return strcmp(ta->name, tb->name);
+}
+
+test_result_t basic_run_tests_parallel(driver_env_t env, struct testcase *all_tests[], int num_tests, int *tests_done,
+                                       int *tests_failed)
+{
+    /* start the longest tests first, so the short ones can fill in the gaps at the end */
+    struct testcase *tests[num_tests];
+    memcpy(tests, all_tests, sizeof(tests));
+    qsort(tests, num_tests, sizeof(struct testcase *), test_runtime_comparator);
+
+    regex_t reg;
+    int error = regcomp(&reg, CONFIG_PARALLEL_EXCLUSIVE_REGEX, REG_EXTENDED | REG_NOSUB);
+    ZF_LOGF_IF(error, "Error compiling regex \"%s\"\n", CONFIG_PARALLEL_EXCLUSIVE_REGEX);
+
+    test_result_t stop = SUCCESS;
+    bool exclusive_running = false;
+    int running = 0;
+    int next = 0;
+
+    while (1) {
+        /* start tests in order until we run out of free slots */
+        while (stop == SUCCESS && !exclusive_running && next < num_tests) {
+            if (tests[next]->test_type != BASIC) {
+                next++;
+                continue;
+            }
+
+            bool exclusive = env->num_slots == 1 || regexec(&reg, tests[next]->name, 0, NULL, 0) == 0 ||
+                             test_needs_machine(tests[next]);
+            test_slot_t *slot;
+            if (exclusive) {
+                /* wait for the machine to drain before starting an exclusive test */
+                slot = running == 0 ? &env->slots[0] : NULL;
+            } else {
+                slot = free_slot(env);
+            }
+            if (slot == NULL) {
+                break;
+            }
+
+            int s = slot - env->slots;
+            slot->exclusive = exclusive;
+            slot->untypeds = exclusive ? env->untypeds : slot_untypeds[s];
+            slot->num_untypeds = exclusive ? env->num_untypeds : slot_num_untypeds[s];
+            slot->untyped_cnode = exclusive ? env->untyped_cnode : slot_untyped_cnodes[s];
+            slot->phase_start = test_timestamp(env);
+            slot_set_up(env, slot, tests[next]);
+            slot->times.phase[TEST_PHASE_SET_UP] = test_time_elapsed(env, &slot->phase_start);
+            slot_start(env, slot, tests[next]);
+            exclusive_running = exclusive;
+            running++;
+            next++;
+        }
+
+        if (running == 0) {
+            break;
+        }
+
+        test_slot_t *slot = NULL;
+        int result = sel4test_driver_wait(env, &slot);
+        struct testcase *test = slot->test;
+        slot->times.phase[TEST_PHASE_RUN] = test_time_elapsed(env, &slot->phase_start);
+        /* results are reported in the order tests finish. The test is started
+         * before it is torn down so the rest of its output is part of it. */
+        sel4test_start_test(test->name, *tests_done);
+        slot_record_memory(slot);
+        slot_tear_down(env, slot);
+        slot->times.phase[TEST_PHASE_TEAR_DOWN] = test_time_elapsed(env, &slot->phase_start);
+        exclusive_running = false;
+        running--;
+
+        sel4test_end_test(result, &slot->times);
+        if (result != SUCCESS) {
+            (*tests_failed)++;
+            if (stop != ABORT && (config_set(CONFIG_TESTPRINTER_HALT_ON_TEST_FAILURE) || result == ABORT)) {
+                /* let the tests that are already running finish, but don't start any more */
+                stop = result;
+            }
+        }
+        (*tests_done)++;
+    }
+
+    regfree(&reg);
+    return stop;
+}
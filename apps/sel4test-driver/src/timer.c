@@ -7,29 +7,141 @@
 #include <sel4test-driver/gen_config.h>
 #include <sel4/sel4.h>
 #include "timer.h"
+#include "results.h"
+#include <stdio.h>
 #include <utils/util.h>
 #include <sel4testsupport/testreporter.h>
+#ifdef CONFIG_ARCH_X86
+#include <platsupport/arch/tsc.h>
+#endif
 
-struct sel4test_ack_data {
-    driver_env_t env;
-    int nth_timer;
+/* Pending timeout requests from each timer client of the test */
+struct time_server_client {
+    /* badged notification cap the client's timeouts are signalled on */
+    seL4_CPtr notification;
+    timer_wheel_entry_t timeout;
 };
-typedef struct sel4test_ack_data sel4test_ack_data_t;
+static struct time_server_client timeServer_clients[TIMER_CLIENTS];
+/* watchdog of each test slot */
+static timer_wheel_entry_t watchdogs[MAX_TEST_SLOTS];
 
-/* A pending timeout requests from tests */
-static bool timeServer_timeoutPending = false;
-static timeout_type_t timeServer_timeoutType;
+/* With CONFIG_TIMER_LATENCY, when the driver saw the timer IRQ it is handling,
+ * or 0 if it isn't handling one. It is set by handle_timer_interrupts and only
+ * cleared once timer_update has fired the timeouts, so that timeout_cb can
+ * record how long the tests waited to be signalled. */
+static driver_env_t latency_env;
+static uint64_t irq_time;
 
-static int timeout_cb(uintptr_t token)
+void latency_hist_record(latency_hist_t *hist, uint64_t ns)
+{
+    int bucket = ns < 2 ? 0 : MIN(LATENCY_BUCKETS - 1, 63 - __builtin_clzll(ns));
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->total += ns;
+    hist->max = MAX(hist->max, ns);
+}
+
+uint64_t latency_hist_percentile(const latency_hist_t *hist, int percent)
+{
+    uint64_t rank = (hist->count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank && seen > 0) {
+            return MIN(hist->max, (UINT64_C(2) << i) - 1);
+        }
+    }
+    return hist->max;
+}
+
+static void print_latency_hist(const char *name, const latency_hist_t *hist)
+{
+    printf("%s: %llu samples", name, (unsigned long long) hist->count);
+    if (hist->count == 0) {
+        printf("\n");
+        return;
+    }
+    printf(", mean %llu ns, max %llu ns\n", (unsigned long long)(hist->total / hist->count),
+           (unsigned long long) hist->max);
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        if (hist->buckets[i] != 0) {
+            printf("\t%llu-%llu ns: %llu\n", i == 0 ? 0ull : 1ull << i, (2ull << i) - 1,
+                   (unsigned long long) hist->buckets[i]);
+        }
+    }
+}
+
+void print_timer_latency(driver_env_t env)
 {
-    seL4_Signal((seL4_CPtr) token);
+    print_latency_hist("Timer IRQ to callback returning", &env->timer_callback_latency);
+    print_latency_hist("Timer IRQ to test signalled", &env->timer_signal_latency);
+}
 
-    if (timeServer_timeoutType != TIMEOUT_PERIODIC) {
-        timeServer_timeoutPending = false;
+static void result_latency_hist(const char *prefix, const latency_hist_t *hist)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s_samples", prefix);
+    result_sample(name, hist->count);
+    if (hist->count == 0) {
+        return;
+    }
+    snprintf(name, sizeof(name), "%s_mean_ns", prefix);
+    result_sample(name, hist->total / hist->count);
+    snprintf(name, sizeof(name), "%s_p99_ns", prefix);
+    result_sample(name, latency_hist_percentile(hist, 99));
+    snprintf(name, sizeof(name), "%s_max_ns", prefix);
+    result_sample(name, hist->max);
+}
+
+void result_timer_latency(driver_env_t env)
+{
+    result_latency_hist("timer_callback_latency", &env->timer_callback_latency);
+    result_latency_hist("timer_signal_latency", &env->timer_signal_latency);
+}
+
+static int timeout_cb(uintptr_t token)
+{
+    struct time_server_client *client = (struct time_server_client *) token;
+    seL4_Signal(client->notification);
+    if (config_set(CONFIG_TIMER_LATENCY) && irq_time != 0) {
+        latency_hist_record(&latency_env->timer_signal_latency, timestamp(latency_env) - irq_time);
     }
     return 0;
 }
 
+static int timer_wheel_cb(uintptr_t token)
+{
+    driver_env_t env = (driver_env_t) token;
+    /* the time manager doesn't have a timeout for the wheel any more */
+    env->timer_wheel_wakeup = UINT64_MAX;
+    return 0;
+}
+
+void timer_wheel_update(driver_env_t env)
+{
+    int error;
+    do {
+        timer_wheel_expire(&env->timer_wheel, timestamp(env));
+        uint64_t next;
+        if (!timer_wheel_next(&env->timer_wheel, &next)) {
+            if (env->timer_wheel_wakeup != UINT64_MAX) {
+                error = tm_deregister_cb(&env->tm, TIMER_WHEEL_ID);
+                ZF_LOGF_IF(error, "Failed to cancel the timer wheel's timeout");
+                env->timer_wheel_wakeup = UINT64_MAX;
+            }
+            return;
+        }
+        if (next == env->timer_wheel_wakeup) {
+            return;
+        }
+        error = tm_register_cb(&env->tm, TIMEOUT_ABSOLUTE, next, 0, TIMER_WHEEL_ID, timer_wheel_cb,
+                               (uintptr_t) env);
+        ZF_LOGF_IF(error != 0 && error != ETIME, "Failed to set the timer wheel's timeout");
+        env->timer_wheel_wakeup = error ? UINT64_MAX : next;
+        /* if the time has already passed, go round again */
+    } while (error == ETIME);
+}
+
 static int ack_timer_interrupts(void *ack_data)
 {
     ZF_LOGF_IF(!ack_data, "ack_data is NULL");
@@ -42,24 +154,37 @@ static int ack_timer_interrupts(void *ack_data)
     int error = seL4_IRQHandler_Ack(env->timer_irqs[nth_timer].handler_path.capPtr);
     ZF_LOGF_IF(error, "Failed to acknowledge timer IRQ handler");
 
-    ps_free(&env->ops.malloc_ops, sizeof(sel4test_ack_data_t), ack_data);
+    timer_ack_data->pending = false;
     return error;
 }
 
 void handle_timer_interrupts(driver_env_t env, seL4_Word badge)
 {
-    int error = 0;
+    if (config_set(CONFIG_TIMER_LATENCY)) {
+        latency_env = env;
+        irq_time = timestamp(env);
+    }
     while (badge) {
         seL4_Word badge_bit = CTZL(badge);
-        sel4test_ack_data_t *ack_data = NULL;
-        error = ps_calloc(&env->ops.malloc_ops, 1, sizeof(sel4test_ack_data_t), (void **) &ack_data);
-        ZF_LOGF_IF(error, "Failed to allocate memory for ack token");
-        ack_data->env = env;
-        ack_data->nth_timer = (int) badge_bit;
+        sel4test_ack_data_t *ack_data = &env->timer_acks[badge_bit];
+        ZF_LOGF_IF(ack_data->pending, "Timer IRQ %d arrived before it was acknowledged", (int) badge_bit);
+        ack_data->pending = true;
         env->timer_cbs[badge_bit].callback(env->timer_cbs[badge_bit].callback_data,
                                            ack_timer_interrupts, ack_data);
         badge &= ~BIT(badge_bit);
     }
+    if (config_set(CONFIG_TIMER_LATENCY)) {
+        latency_hist_record(&env->timer_callback_latency, timestamp(env) - irq_time);
+    }
+}
+
+void timer_update(driver_env_t env)
+{
+    int error = tm_update(&env->tm);
+    ZF_LOGF_IF(error, "Failed to update time manager");
+    timer_wheel_update(env);
+    /* the timeouts due for this IRQ have all been signalled by now */
+    irq_time = 0;
 }
 
 void wait_for_timer_interrupt(driver_env_t env)
@@ -69,25 +194,46 @@ void wait_for_timer_interrupt(driver_env_t env)
         seL4_Wait(env->timer_notification.cptr, &sender_badge);
         if (sender_badge) {
             handle_timer_interrupts(env, sender_badge);
+            /* the caller updates the time manager itself, so nothing is signalled */
+            irq_time = 0;
         }
     } else {
         ZF_LOGF("There is no timer configured for this target");
     }
 }
 
-void timeout(driver_env_t env, uint64_t ns, timeout_type_t timeout_type)
+void timeout(driver_env_t env, int client, uint64_t ns, timeout_type_t timeout_type)
 {
     if (config_set(CONFIG_HAVE_TIMER)) {
-        ZF_LOGD_IF(timeServer_timeoutPending, "Overwriting a previous timeout request\n");
-        timeServer_timeoutType = timeout_type;
-        int error = tm_register_cb(&env->tm, timeout_type, ns, 0,
-                                   TIMER_ID, timeout_cb, env->timer_notify_test.cptr);
-        if (error == ETIME) {
-            error = timeout_cb(env->timer_notify_test.cptr);
-        } else {
-            timeServer_timeoutPending = true;
+        ZF_LOGF_IF(client < 0 || client >= TIMER_CLIENTS, "Invalid timer client %d", client);
+        ZF_LOGF_IF(timeout_type == TIMEOUT_PERIODIC && ns == 0, "Periodic timeout with a period of 0");
+        struct time_server_client *c = &timeServer_clients[client];
+        ZF_LOGD_IF(c->timeout.pending, "Overwriting a previous timeout request\n");
+        c->notification = env->timer_client_signals[client].capPtr;
+
+        uint64_t now = timestamp(env);
+        uint64_t deadline = timeout_type == TIMEOUT_ABSOLUTE ? ns : now + ns;
+        if (timeout_type != TIMEOUT_PERIODIC && deadline <= now) {
+            timer_wheel_remove(&env->timer_wheel, &c->timeout);
+            timeout_cb((uintptr_t) c);
+            return;
         }
-        ZF_LOGF_IF(error != 0, "register_cb failed");
+        /* bring the wheel up to now before adding to it */
+        timer_wheel_expire(&env->timer_wheel, now);
+        timer_wheel_add(&env->timer_wheel, &c->timeout, deadline, timeout_type == TIMEOUT_PERIODIC ? ns : 0,
+                        timeout_cb, (uintptr_t) c);
+        timer_wheel_update(env);
+    } else {
+        ZF_LOGF("There is no timer configured for this target");
+    }
+}
+
+void timer_reset_client(driver_env_t env, int client)
+{
+    if (config_set(CONFIG_HAVE_TIMER)) {
+        ZF_LOGF_IF(client < 0 || client >= TIMER_CLIENTS, "Invalid timer client %d", client);
+        timer_wheel_remove(&env->timer_wheel, &timeServer_clients[client].timeout);
+        timer_wheel_update(env);
     } else {
         ZF_LOGF("There is no timer configured for this target");
     }
@@ -96,14 +242,24 @@ void timeout(driver_env_t env, uint64_t ns, timeout_type_t timeout_type)
 void timer_reset(driver_env_t env)
 {
     if (config_set(CONFIG_HAVE_TIMER)) {
-        int error = tm_deregister_cb(&env->tm, TIMER_ID);
-        ZF_LOGF_IF(error, "ltimer_rest failed");
-        timeServer_timeoutPending = false;
+        for (int client = 0; client < TIMER_CLIENTS; client++) {
+            timer_wheel_remove(&env->timer_wheel, &timeServer_clients[client].timeout);
+        }
+        timer_wheel_update(env);
     } else {
         ZF_LOGF("There is no timer configured for this target");
     }
 }
 
+void timer_wheel_setup(driver_env_t env)
+{
+    ZF_LOGF_IF(!config_set(CONFIG_HAVE_TIMER), "There is no timer configured for this target");
+    int error = tm_alloc_id_at(&env->tm, TIMER_WHEEL_ID);
+    ZF_LOGF_IF(error, "Failed to alloc time id %d", TIMER_WHEEL_ID);
+    timer_wheel_init(&env->timer_wheel, timestamp(env));
+    env->timer_wheel_wakeup = UINT64_MAX;
+}
+
 uint64_t timestamp(driver_env_t env)
 {
     uint64_t time = 0;
@@ -117,9 +273,87 @@ uint64_t timestamp(driver_env_t env)
     return time;
 }
 
-void timer_cleanup(driver_env_t env)
+void clock_page_update(driver_env_t env)
+{
+    uint64_t freq = clock_counter_freq();
+#if defined(CONFIG_ARCH_X86)
+    freq = (uint64_t) env->init->tsc_freq * US_IN_S;
+#endif
+    if (!config_set(CONFIG_HAVE_TIMER)) {
+        /* there is no time to line up with, so count from now */
+        clock_page_set(env->clock, freq, clock_counter(), 0);
+        return;
+    }
+    /* reading the timer takes a while, so take the count from halfway through */
+    uint64_t before = clock_counter();
+    uint64_t now = timestamp(env);
+    uint64_t after = clock_counter();
+    clock_page_set(env->clock, freq, before + (after - before) / 2, now);
+}
+
+static int watchdog_cb(uintptr_t token)
+{
+    *(bool *) token = true;
+    return 0;
+}
+
+void watchdog_start(driver_env_t env, int slot, uint64_t ns, bool *expired)
+{
+    ZF_LOGF_IF(!config_set(CONFIG_HAVE_TIMER), "There is no timer configured for this target");
+    *expired = false;
+    uint64_t now = timestamp(env);
+    timer_wheel_expire(&env->timer_wheel, now);
+    timer_wheel_add(&env->timer_wheel, &watchdogs[slot], now + ns, 0, watchdog_cb, (uintptr_t) expired);
+    timer_wheel_update(env);
+}
+
+void watchdog_cancel(driver_env_t env, int slot)
 {
     ZF_LOGF_IF(!config_set(CONFIG_HAVE_TIMER), "There is no timer configured for this target");
-    tm_free_id(&env->tm, TIMER_ID);
-    timeServer_timeoutPending = false;
+    timer_wheel_remove(&env->timer_wheel, &watchdogs[slot]);
+    timer_wheel_update(env);
+}
+
+uint64_t test_timestamp(driver_env_t env)
+{
+    if (config_set(CONFIG_HAVE_TIMER)) {
+        return timestamp(env);
+    }
+#ifdef CONFIG_ARCH_X86
+    return rdtsc_pure();
+#else
+    return 0;
+#endif
+}
+
+const char *test_timestamp_units(void)
+{
+    if (config_set(CONFIG_HAVE_TIMER)) {
+        return "ns";
+    }
+    return config_set(CONFIG_ARCH_X86) ? "cycles" : NULL;
+}
+
+uint64_t test_time_elapsed(driver_env_t env, uint64_t *since)
+{
+    uint64_t now = test_timestamp(env);
+    uint64_t elapsed = now - *since;
+    *since = now;
+    return elapsed;
+}
+
+uint64_t boot_timestamp(void)
+{
+    uint64_t count = clock_counter();
+    uint64_t freq = clock_counter_freq();
+    /* the TSC's frequency isn't known this early, so it is left in cycles */
+    return freq != 0 ? clock_ticks_to_ns(count, freq) : count;
+}
+
+const char *boot_timestamp_units(void)
+{
+    if (!CLOCK_COUNTER_AVAILABLE) {
+        return NULL;
+    }
+    return clock_counter_freq() != 0 ? "ns" : "cycles";
 }
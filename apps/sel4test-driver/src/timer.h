@@ -9,12 +9,59 @@
 #include "test.h"
 #include <sel4testsupport/testreporter.h>
 
+/* Time manager id for tests of the time manager itself */
 #define TIMER_ID 0
+/* Time manager id of the timer wheel that has the timeouts of the test
+ * processes' timer clients and the watchdogs */
+#define TIMER_WHEEL_ID 1
+#define NUM_TIMER_IDS 2
 
 /* Timing related functions used only by in sel4test-driver */
 void handle_timer_interrupts(driver_env_t env, seL4_Word badge);
 void wait_for_timer_interrupt(driver_env_t env);
-void timeout(driver_env_t env, uint64_t ns, timeout_type_t timeout);
+void timeout(driver_env_t env, int client, uint64_t ns, timeout_type_t timeout);
 uint64_t timestamp(driver_env_t env);
+/* Cancel the timeouts of every timer client, or of one */
 void timer_reset(driver_env_t env);
-void timer_cleanup(driver_env_t env);
+void timer_reset_client(driver_env_t env, int client);
+/* Set up the timer wheel, once the time manager is */
+void timer_wheel_setup(driver_env_t env);
+/* Update the time manager and the timer wheel after handle_timer_interrupts,
+ * firing any timeouts that are due. handle_timer_interrupts leaves the time of
+ * the IRQ for the timeouts to measure their latency from, until this is done. */
+void timer_update(driver_env_t env);
+/* Fire the timeouts in the wheel that are due, and have the time manager wake
+ * the wheel up when the next might be. Call this after changing the wheel. */
+void timer_wheel_update(driver_env_t env);
+
+/* Set *expired once ns have passed, unless the watchdog is cancelled first */
+void watchdog_start(driver_env_t env, int slot, uint64_t ns, bool *expired);
+void watchdog_cancel(driver_env_t env, int slot);
+
+/* Add a latency to a histogram, and the latency at or below which at least the
+ * given percentage of those added fall. The percentile is only as precise as
+ * the buckets, so it is the top of the bucket it is in, or the max if lower. */
+void latency_hist_record(latency_hist_t *hist, uint64_t ns);
+uint64_t latency_hist_percentile(const latency_hist_t *hist, int percent);
+/* Print the timer IRQ latencies recorded with CONFIG_TIMER_LATENCY */
+void print_timer_latency(driver_env_t env);
+/* Send the same as result samples, for CONFIG_BINARY_RESULTS */
+void result_timer_latency(driver_env_t env);
+
+/* Line the clock page up with timestamp(), see clock_page.h */
+void clock_page_update(driver_env_t env);
+
+/* Timestamps for timing the phases of each test. These are in ns when there
+ * is a timer, otherwise in TSC cycles on x86 and always 0 elsewhere. */
+uint64_t test_timestamp(driver_env_t env);
+/* "ns" or "cycles", or NULL if tests can't be timed */
+const char *test_timestamp_units(void);
+/* Time since *since, which is then updated to now */
+uint64_t test_time_elapsed(driver_env_t env, uint64_t *since);
+
+/* Timestamps for profiling the boot, which work before the timer is set up. These
+ * are read from clock_counter, in ns on aarch64 when a counter is exported to
+ * user level, in TSC cycles on x86 and always 0 elsewhere. */
+uint64_t boot_timestamp(void);
+/* "ns" or "cycles", or NULL if the boot can't be profiled */
+const char *boot_timestamp_units(void);
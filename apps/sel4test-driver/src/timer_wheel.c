@@ -0,0 +1,210 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#include <string.h>
+
+#include <utils/util.h>
+
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define SLOT_BIT(slot) ((uint64_t) 1 << (slot))
+/* ticks the top level reaches */
+#define WHEEL_RANGE_BITS (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)
+
+static inline int level_shift(int level)
+{
+    return TIMER_WHEEL_SLOT_BITS * level;
+}
+
+static inline timer_wheel_entry_t **entry_list(timer_wheel_t *wheel, timer_wheel_entry_t *entry)
+{
+    if (entry->level == TIMER_WHEEL_LEVELS) {
+        return &wheel->expiring;
+    }
+    return &wheel->slots[entry->level][entry->slot];
+}
+
+static void push(timer_wheel_t *wheel, timer_wheel_entry_t *entry, int level, int slot)
+{
+    entry->level = level;
+    entry->slot = slot;
+    timer_wheel_entry_t **list = entry_list(wheel, entry);
+    entry->prev = NULL;
+    entry->next = *list;
+    if (*list != NULL) {
+        (*list)->prev = entry;
+    }
+    *list = entry;
+    if (level < TIMER_WHEEL_LEVELS) {
+        wheel->occupied[level] |= SLOT_BIT(slot);
+    }
+}
+
+static void unlink_entry(timer_wheel_t *wheel, timer_wheel_entry_t *entry)
+{
+    timer_wheel_entry_t **list = entry_list(wheel, entry);
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        *list = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    }
+    if (*list == NULL && entry->level < TIMER_WHEEL_LEVELS) {
+        wheel->occupied[entry->level] &= ~SLOT_BIT(entry->slot);
+    }
+}
+
+/* Put a pending entry in the slot for its deadline */
+static void place(timer_wheel_t *wheel, timer_wheel_entry_t *entry)
+{
+    /* round up, so that an entry never fires early */
+    uint64_t expires = (entry->deadline >> TIMER_WHEEL_TICK_BITS) +
+                       ((entry->deadline & MASK(TIMER_WHEEL_TICK_BITS)) != 0);
+    expires = MAX(expires, wheel->now);
+    uint64_t delta = expires - wheel->now;
+    if (delta >> WHEEL_RANGE_BITS) {
+        /* wait as long as possible and then be placed again */
+        expires = wheel->now + MASK(WHEEL_RANGE_BITS);
+        delta = MASK(WHEEL_RANGE_BITS);
+    }
+    int level = 0;
+    while (delta >> level_shift(level + 1)) {
+        level++;
+    }
+    push(wheel, entry, level, (expires >> level_shift(level)) & SLOT_MASK);
+}
+
+/* Move the entries of the slot at the start of each level that the wheel has
+ * just got to down a level. */
+static void cascade(timer_wheel_t *wheel)
+{
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        int slot = (wheel->now >> level_shift(level)) & SLOT_MASK;
+        timer_wheel_entry_t *entry = wheel->slots[level][slot];
+        wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] &= ~SLOT_BIT(slot);
+        while (entry != NULL) {
+            timer_wheel_entry_t *next = entry->next;
+            place(wheel, entry);
+            entry = next;
+        }
+        if (slot != 0) {
+            break;
+        }
+    }
+}
+
+/* Distance from slot from to the next slot with entries, going round */
+static inline int next_occupied(uint64_t occupied, int from)
+{
+    uint64_t rotated = from == 0 ? occupied : (occupied >> from) | (occupied << (TIMER_WHEEL_SLOTS - from));
+    return __builtin_ctzll(rotated);
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now >> TIMER_WHEEL_TICK_BITS;
+}
+
+void timer_wheel_add(timer_wheel_t *wheel, timer_wheel_entry_t *entry, uint64_t deadline, uint64_t period,
+                     timer_wheel_cb_t callback, uintptr_t token)
+{
+    timer_wheel_remove(wheel, entry);
+    entry->deadline = deadline;
+    entry->period = period;
+    entry->callback = callback;
+    entry->token = token;
+    entry->pending = true;
+    wheel->count++;
+    place(wheel, entry);
+}
+
+void timer_wheel_remove(timer_wheel_t *wheel, timer_wheel_entry_t *entry)
+{
+    if (!entry->pending) {
+        return;
+    }
+    unlink_entry(wheel, entry);
+    entry->pending = false;
+    wheel->count--;
+}
+
+int timer_wheel_expire(timer_wheel_t *wheel, uint64_t now)
+{
+    uint64_t target = now >> TIMER_WHEEL_TICK_BITS;
+    int fired = 0;
+
+    while (wheel->now <= target) {
+        int slot = wheel->now & SLOT_MASK;
+        bool due = wheel->occupied[0] & SLOT_BIT(slot);
+        if (due) {
+            wheel->expiring = wheel->slots[0][slot];
+            wheel->slots[0][slot] = NULL;
+            wheel->occupied[0] &= ~SLOT_BIT(slot);
+            for (timer_wheel_entry_t *entry = wheel->expiring; entry != NULL; entry = entry->next) {
+                entry->level = TIMER_WHEEL_LEVELS;
+            }
+        }
+
+        /* Move on before firing anything, so that entries added by the
+         * callbacks go after this tick. Skip straight past empty ticks, but
+         * stop at the start of the next level 0 round to move entries down. */
+        if (wheel->count == 0) {
+            wheel->now = target + 1;
+        } else if (!due && wheel->occupied[0] == 0) {
+            wheel->now = MIN(target + 1, (wheel->now | SLOT_MASK) + 1);
+        } else {
+            wheel->now++;
+        }
+        if ((wheel->now & SLOT_MASK) == 0) {
+            cascade(wheel);
+        }
+
+        while (wheel->expiring != NULL) {
+            timer_wheel_entry_t *entry = wheel->expiring;
+            timer_wheel_remove(wheel, entry);
+            if (entry->period != 0) {
+                /* skip any periods that were missed */
+                uint64_t missed = now >= entry->deadline ? (now - entry->deadline) / entry->period : 0;
+                timer_wheel_add(wheel, entry, entry->deadline + (missed + 1) * entry->period, entry->period,
+                                entry->callback, entry->token);
+            }
+            entry->callback(entry->token);
+            fired++;
+        }
+    }
+    return fired;
+}
+
+bool timer_wheel_next(const timer_wheel_t *wheel, uint64_t *next)
+{
+    if (wheel->count == 0) {
+        return false;
+    }
+    uint64_t first = UINT64_MAX;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        if (wheel->occupied[level] == 0) {
+            continue;
+        }
+        int shift = level_shift(level);
+        int slot = (wheel->now >> shift) & SLOT_MASK;
+        uint64_t tick;
+        if (level == 0) {
+            tick = wheel->now + next_occupied(wheel->occupied[0], slot);
+        } else {
+            /* the current slot of a level above 0 has already been moved
+             * down, so anything in it is a whole round away */
+            int distance = next_occupied(wheel->occupied[level], (slot + 1) & SLOT_MASK) + 1;
+            tick = ((wheel->now >> shift) + distance) << shift;
+        }
+        first = MIN(first, tick);
+    }
+    *next = first << TIMER_WHEEL_TICK_BITS;
+    return true;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A hierarchical timer wheel for the driver's timeouts. Time is in ns and
+ * deadlines are rounded up to a tick, so timeouts due in the same tick are
+ * fired together. Level 0 has a slot for each of the next TIMER_WHEEL_SLOTS
+ * ticks, and each level above it has a slot for TIMER_WHEEL_SLOTS of the slots
+ * of the level below. The timeouts in a slot above level 0 are moved down a
+ * level when the wheel gets to the start of that slot. Timeouts further away
+ * than the top level reaches wait in its last slot and are placed again when
+ * it is moved down.
+ *
+ * Adding and removing a timeout take constant time, and nothing is allocated:
+ * each timeout is an entry that its owner keeps. */
+
+/* a tick is 2^16 ns, about 66us */
+#define TIMER_WHEEL_TICK_BITS 16
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+/* with 4 levels, timeouts up to about 18 minutes away are placed directly */
+#define TIMER_WHEEL_LEVELS 4
+
+typedef int (*timer_wheel_cb_t)(uintptr_t token);
+
+typedef struct timer_wheel_entry {
+    struct timer_wheel_entry *next;
+    struct timer_wheel_entry *prev;
+    uint64_t deadline;
+    /* 0 for a timeout that only fires once */
+    uint64_t period;
+    timer_wheel_cb_t callback;
+    uintptr_t token;
+    /* where the entry is: a level and slot, the list of entries being fired
+     * if level is TIMER_WHEEL_LEVELS, or nowhere if it isn't pending */
+    bool pending;
+    uint8_t level;
+    uint8_t slot;
+} timer_wheel_entry_t;
+
+typedef struct timer_wheel {
+    /* the next tick to expire */
+    uint64_t now;
+    /* number of pending entries */
+    int count;
+    /* bit i is set if slot i of that level has any entries */
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    timer_wheel_entry_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    /* entries being fired by timer_wheel_expire */
+    timer_wheel_entry_t *expiring;
+} timer_wheel_t;
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now);
+
+/* Call callback with token once the time reaches deadline, and then every
+ * period after that if period isn't 0. If the entry is already pending it is
+ * moved. A deadline that has passed fires in the next tick that is expired. */
+void timer_wheel_add(timer_wheel_t *wheel, timer_wheel_entry_t *entry, uint64_t deadline, uint64_t period,
+                     timer_wheel_cb_t callback, uintptr_t token);
+/* Cancel the entry, if it is pending. Callbacks can remove any entry. */
+void timer_wheel_remove(timer_wheel_t *wheel, timer_wheel_entry_t *entry);
+
+/* Fire all the timeouts due by now in one pass, and return how many there were.
+ * Callbacks may add and remove entries. */
+int timer_wheel_expire(timer_wheel_t *wheel, uint64_t now);
+
+/* The time to next call timer_wheel_expire at, or false if nothing is pending.
+ * This is exact for timeouts in level 0, and for the others is when they are
+ * next moved down a level, so the wheel may be woken up before any are due. */
+bool timer_wheel_next(const timer_wheel_t *wheel, uint64_t *next);
@@ -0,0 +1 @@
+../../sel4test-driver/include/clock_page.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../sel4test-driver/include/log_ring.h
\ No newline at end of file
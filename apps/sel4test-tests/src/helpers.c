@@ -21,7 +21,9 @@
 #include <sel4platsupport/timer.h>
 
 #include "helpers.h"
+#include "init.h"
 #include "test.h"
+#include "clock_page.h"
 
 char __attribute__((aligned(16))) process_tls[1024 * 16];
 
@@ -255,6 +257,7 @@ NORETURN static void helper_process(int argc, char **argv)
 {
     uintptr_t new_tp = sel4runtime_move_initial_tls(process_tls);
     assert(new_tp != (uintptr_t)NULL);
+    init_helper_output();
 
     helper_thread(argc, argv);
 }
@@ -415,22 +418,45 @@ uintptr_t get_helper_initial_stack_pointer(helper_thread_t *thread)
     return (uintptr_t)thread->thread.initial_stack_pointer;
 }
 
+/* notifications of the timer clients, see TIMER_CLIENTS */
+static seL4_CPtr timer_client_ntfns[TIMER_CLIENTS];
+
+void init_timer_clients(const seL4_CPtr *ntfns)
+{
+    memcpy(timer_client_ntfns, ntfns, sizeof(timer_client_ntfns));
+}
+
+/* the driver's clock page, if CONFIG_CLOCK_PAGE is set */
+static const clock_page_t *clock_page;
+
+void init_clock_page(const void *page)
+{
+    clock_page = page;
+}
+
 static void sel4test_send_time_request(seL4_CPtr ep, uint64_t ns, sel4test_output_t request_type,
-                                       timeout_type_t timeout_type)
+                                       timeout_type_t timeout_type, int client)
 {
     seL4_MessageInfo_t tag;
+    /* a reset can also be for every client */
+    assert((client >= 0 && client < TIMER_CLIENTS) ||
+           (request_type == SEL4TEST_TIME_RESET && client == TIMER_ALL_CLIENTS));
     seL4_SetMR(0, request_type);
 
     switch (request_type) {
     case SEL4TEST_TIME_TIMEOUT:
         seL4_SetMR(1, timeout_type);
         sel4utils_64_set_mr(2, ns);
-        tag = seL4_MessageInfo_new(0, 0, 0, (seL4_Uint32) SEL4UTILS_64_WORDS + 2);
+        seL4_SetMR(SEL4UTILS_64_WORDS + 2, client);
+        tag = seL4_MessageInfo_new(0, 0, 0, (seL4_Uint32) SEL4UTILS_64_WORDS + 3);
         break;
     case SEL4TEST_TIME_TIMESTAMP:
-    case SEL4TEST_TIME_RESET:
         tag = seL4_MessageInfo_new(0, 0, 0, 1);
         break;
+    case SEL4TEST_TIME_RESET:
+        seL4_SetMR(1, client);
+        tag = seL4_MessageInfo_new(0, 0, 0, 2);
+        break;
     default:
         ZF_LOGE("Invalid time request\n");
         break;
@@ -467,10 +493,11 @@ inline void sel4test_sleep(env_t env, uint64_t ns)
      * being serialised, and wait on the same env->timer_notification at the same time,
      * in which case the first thread in the queue will only be notified and not the
      * other(s). This is a limitation, and the current interface won't handle it. Only
-     * one thread can request/wait/sleep/wakeup on a time.
+     * one thread can request/wait/sleep/wakeup on a time. Threads that need to
+     * sleep at the same time should each use their own timer client.
      */
 
-    sel4test_send_time_request(env->endpoint, ns, SEL4TEST_TIME_TIMEOUT, TIMEOUT_RELATIVE);
+    sel4test_send_time_request(env->endpoint, ns, SEL4TEST_TIME_TIMEOUT, TIMEOUT_RELATIVE, 0);
     /* The tests have a timer_notification that they can wait on by default.
      * sel4-driver will notify us on timer_notification when it gets a timer interrupt
      */
@@ -479,7 +506,31 @@ inline void sel4test_sleep(env_t env, uint64_t ns)
 
 inline void sel4test_periodic_start(env_t env, uint64_t ns)
 {
-    sel4test_send_time_request(env->endpoint, ns, SEL4TEST_TIME_TIMEOUT, TIMEOUT_PERIODIC);
+    sel4test_send_time_request(env->endpoint, ns, SEL4TEST_TIME_TIMEOUT, TIMEOUT_PERIODIC, 0);
+}
+
+void sel4test_sleep_client(env_t env, int client, uint64_t ns)
+{
+    sel4test_send_time_request(env->endpoint, ns, SEL4TEST_TIME_TIMEOUT, TIMEOUT_RELATIVE, client);
+    sel4test_ntfn_timer_wait_client(env, client);
+}
+
+void sel4test_periodic_start_client(env_t env, int client, uint64_t ns)
+{
+    sel4test_send_time_request(env->endpoint, ns, SEL4TEST_TIME_TIMEOUT, TIMEOUT_PERIODIC, client);
+}
+
+void sel4test_timer_reset_client(env_t env, int client)
+{
+    sel4test_send_time_request(env->endpoint, 0, SEL4TEST_TIME_RESET, 0, client);
+}
+
+seL4_Word sel4test_ntfn_timer_wait_client(UNUSED env_t env, int client)
+{
+    assert(client >= 0 && client < TIMER_CLIENTS);
+    seL4_Word badge = 0;
+    seL4_Wait(timer_client_ntfns[client], &badge);
+    return badge;
 }
 
 uint64_t sel4test_timestamp(env_t env)
@@ -491,7 +542,12 @@ uint64_t sel4test_timestamp(env_t env)
      */
     uint64_t time = 0;
 
-    sel4test_send_time_request(env->endpoint, 0, SEL4TEST_TIME_TIMESTAMP, 0);
+    /* the clock page gives the same time without leaving the test */
+    if (config_set(CONFIG_CLOCK_PAGE) && clock_page != NULL && clock_page_read(clock_page, &time)) {
+        return time;
+    }
+
+    sel4test_send_time_request(env->endpoint, 0, SEL4TEST_TIME_TIMESTAMP, 0, 0);
     time = sel4utils_64_get_mr(1);
 
     return time;
@@ -499,7 +555,7 @@ uint64_t sel4test_timestamp(env_t env)
 
 inline void sel4test_timer_reset(env_t env)
 {
-    sel4test_send_time_request(env->endpoint, 0, SEL4TEST_TIME_RESET, 0);
+    sel4test_send_time_request(env->endpoint, 0, SEL4TEST_TIME_RESET, 0, TIMER_ALL_CLIENTS);
 }
 
 inline void sel4test_ntfn_timer_wait(env_t env)
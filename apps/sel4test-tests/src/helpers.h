@@ -154,12 +154,16 @@ void sleep_busy(env_t env, uint64_t ns);
 
 /* Request a sleep for at least @ns. Callees to this function will block until
  * it's waken up and this function then returns. No concurrent calls to sel4test_sleep
- * are allowed, and trying to do this has undefined behavior.
+ * are allowed, and trying to do this has undefined behavior. Use sel4test_sleep_client
+ * for threads that sleep at the same time.
  */
 void sel4test_sleep(env_t env, uint64_t ns);
 
 /* Request a timestamp. Timestamps might not be accurate and report
- * longer time especially if working with multpile domains
+ * longer time especially if working with multpile domains. With
+ * CONFIG_CLOCK_PAGE the time is read from the driver's clock page instead
+ * where there is a counter that can be read at user level, which is much
+ * cheaper than asking the driver.
  */
 uint64_t sel4test_timestamp(env_t env);
 
@@ -173,7 +177,7 @@ uint64_t sel4test_timestamp(env_t env);
 void sel4test_periodic_start(env_t env, uint64_t ns);
 
 /* Request a timer reset. This should cancel receiving signals from
- * previous sleep, periodic calls.
+ * previous sleep, periodic calls, including those of every timer client.
  *
  * If there were previous calls that set timeouts, sleep or periodic timer,
  * they will be discarded, and tests will no longer get notifications on
@@ -193,5 +197,16 @@ void sel4test_timer_reset(env_t env);
  */
 void sel4test_ntfn_timer_wait(env_t env);
 
+/* Timer clients let several threads use the timer independently. Each client,
+ * from 0 to TIMER_CLIENTS - 1, has its own timeout in sel4test-driver and its own
+ * notification, which is signalled with badge TIMER_CLIENT_BADGE(client). Client 0
+ * is the one used by the functions above, so its notification is
+ * env->timer_notification. A new timeout for a client replaces the last one. */
+void sel4test_sleep_client(env_t env, int client, uint64_t ns);
+void sel4test_periodic_start_client(env_t env, int client, uint64_t ns);
+void sel4test_timer_reset_client(env_t env, int client);
+/* Wait for a client's timer, returning the badge it was signalled with */
+seL4_Word sel4test_ntfn_timer_wait_client(env_t env, int client);
+
 /* helper for creating a thread to handle timer interrupts */
 int create_timer_interrupt_thread(env_t env, helper_thread_t *thread);
@@ -12,3 +12,9 @@
 void arch_init_allocator(env_t env, test_init_data_t *data);
 void arch_init_simple(env_t env, simple_t *simple);
 seL4_CPtr get_irq_cap(void *data, int id, irq_type_t irq);
+/* Set the notifications the timer clients are signalled on */
+void init_timer_clients(const seL4_CPtr *ntfns);
+/* Set the driver's clock page that sel4test_timestamp reads */
+void init_clock_page(const void *page);
+/* Print the output of a helper process straight to the console */
+void init_helper_output(void);
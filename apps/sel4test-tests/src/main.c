@@ -5,13 +5,16 @@
  */
 
 #include <autoconf.h>
+#include <sel4test-driver/gen_config.h>
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <arch_stdio.h>
 #include <allocman/vka.h>
 #include <allocman/bootstrap.h>
+#include <allocman/cspace/two_level.h>
 
 #include <sel4/sel4.h>
 #include <sel4/types.h>
@@ -29,6 +32,7 @@
 #include "helpers.h"
 #include "test.h"
 #include "init.h"
+#include "log_ring.h"
 
 /* dummy global for libsel4muslcsys */
 char _cpio_archive[1];
@@ -47,9 +51,47 @@ static sel4utils_alloc_data_t alloc_data;
 #define ALLOCATOR_STATIC_POOL_SIZE ((1 << seL4_PageBits) * 20)
 static char allocator_mem_pool[ALLOCATOR_STATIC_POOL_SIZE];
 
+/* cspace for the allocator when CONFIG_TWO_LEVEL_CSPACE is set */
+static cspace_two_level_t two_level_cspace;
+
+/* output of the current test when QUIET_OUTPUT is set, which is only printed
+ * if the test fails */
+static log_ring_t quiet_log;
+
+/* ring shared with the driver that output goes to when CONFIG_LOG_RING is set */
+static log_ring_t *shared_log;
+
+/* set in helper processes, whose copy of quiet_log is never printed */
+static bool console_output;
+
+/* Helper threads share the rings with the test, and each ring only takes one
+ * writer at a time. The lock is made again each time the allocator is. */
+static sync_mutex_t output_lock;
+static bool output_lock_ready;
+
+void __plat_putchar(int c);
+static size_t console_write(void *data, size_t count)
+{
+    char *buf = data;
+    for (int i = 0; i < count; i++) {
+        __plat_putchar(buf[i]);
+    }
+    return count;
+}
+
+static void quiet_log_flush(bool failed)
+{
+    if (failed && !console_output) {
+        log_ring_replay(&quiet_log, console_write);
+    }
+    log_ring_reset(&quiet_log);
+}
+
 /* override abort, called by exit (and assert fail) */
 void abort(void)
 {
+    quiet_log_flush(true);
+
     /* send back a failure */
     seL4_MessageInfo_t info = seL4_MessageInfo_new(seL4_Fault_NullFault, 0, 0, 1);
     seL4_SetMR(0, -1);
@@ -60,14 +102,39 @@ void abort(void)
     while (1);
 }
 
-void __plat_putchar(int c);
+static void ring_write(log_ring_t *ring, void *data, size_t count, write_buf_fn overflow)
+{
+    bool locked = output_lock_ready;
+    if (locked) {
+        sync_mutex_lock(&output_lock);
+    }
+    log_ring_write(ring, data, count, overflow);
+    if (locked) {
+        sync_mutex_unlock(&output_lock);
+    }
+}
+
 static size_t write_buf(void *data, size_t count)
 {
-    char *buf = data;
-    for (int i = 0; i < count; i++) {
-        __plat_putchar(buf[i]);
+    if (shared_log != NULL) {
+        /* The driver prints it. If the ring is full, print the oldest output
+         * here instead, unless it is only wanted if the test fails. */
+        ring_write(shared_log, data, count, QUIET_OUTPUT ? NULL : console_write);
+        return count;
     }
-    return count;
+    if (QUIET_OUTPUT && !console_output) {
+        ring_write(&quiet_log, data, count, NULL);
+        return count;
+    }
+    return console_write(data, count);
+}
+
+void init_helper_output(void)
+{
+    /* the shared ring isn't mapped into helper processes */
+    shared_log = NULL;
+    output_lock_ready = false;
+    console_output = true;
 }
 
 static testcase_t *find_test(const char *name)
@@ -80,39 +147,234 @@ static testcase_t *find_test(const char *name)
     return test;
 }
 
+/* Amount of untyped memory to give the allocator each time it runs out. A lazy
+ * allocator gets the next untyped on its own, and as the driver hands over the
+ * untypeds biggest first that is the biggest one left. */
+#define UNTYPED_BATCH_BYTES (config_set(CONFIG_LAZY_TEST_ALLOCATOR) ? 1 : BIT(24))
+
+/* state for handing untypeds to the allocator */
+static test_init_data_t *untyped_init_data;
+static vka_t *untyped_vka;
+static vka_t untyped_base_vka;
+
+/* Give the allocator the next untypeds in the list, until at least the given
+ * number of bytes has been added. Returns false if there were none left. */
+static bool add_untyped_batch(size_t bytes)
+{
+    test_init_data_t *init_data = untyped_init_data;
+    seL4_Word num_untypeds = init_data->untypeds.end - init_data->untypeds.start + 1;
+    size_t added = 0;
+
+    while (added < bytes && init_data->untypeds_used < num_untypeds) {
+        cspacepath_t path;
+        vka_cspace_make_path(untyped_vka, init_data->untypeds.start + init_data->untypeds_used, &path);
+        /* allocman doesn't require the paddr unless we need to ask for phys addresses,
+         * which we don't. */
+        size_t size_bits = init_data->untyped_size_bits_list[init_data->untypeds_used];
+        /* count the untyped as used before the allocator can touch it, so the
+         * driver revokes it even if we fault */
+        init_data->untypeds_used++;
+        int error = allocman_utspace_add_uts(untyped_vka->data, 1, &path, &size_bits, NULL,
+                                             ALLOCMAN_UT_KERNEL);
+        if (error) {
+            ZF_LOGF("Failed to add untyped objects to allocator");
+        }
+        added += BIT(size_bits);
+    }
+
+    return added > 0;
+}
+
+static int utspace_alloc_batched(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                 seL4_Word *res)
+{
+    int error;
+    do {
+        error = untyped_base_vka.utspace_alloc(data, dest, type, size_bits, res);
+    } while (error && add_untyped_batch(UNTYPED_BATCH_BYTES));
+    return error;
+}
+
+static int utspace_alloc_maybe_device_batched(void *data, const cspacepath_t *dest, seL4_Word type,
+                                              seL4_Word size_bits, bool can_use_dev, seL4_Word *res)
+{
+    int error;
+    do {
+        error = untyped_base_vka.utspace_alloc_maybe_device(data, dest, type, size_bits, can_use_dev, res);
+    } while (error && add_untyped_batch(UNTYPED_BATCH_BYTES));
+    return error;
+}
+
+/* Accounting of the untyped memory the test uses, when CONFIG_MEMORY_ACCOUNTING
+ * is set. These wrap the rest of the vka, so an allocation only counts once it
+ * succeeds. */
+static test_memory_t *test_memory;
+static vka_t memory_base_vka;
+
+static void memory_allocated(int error, seL4_Word type, seL4_Word size_bits)
+{
+    if (error) {
+        return;
+    }
+    test_memory->bytes += BIT(size_bits);
+    test_memory->peak_bytes = MAX(test_memory->peak_bytes, test_memory->bytes);
+    if (type < seL4_ObjectTypeCount) {
+        test_memory->objects[type]++;
+    }
+}
+
+static int utspace_alloc_counted(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                 seL4_Word *res)
+{
+    int error = memory_base_vka.utspace_alloc(data, dest, type, size_bits, res);
+    memory_allocated(error, type, size_bits);
+    return error;
+}
+
+static int utspace_alloc_maybe_device_counted(void *data, const cspacepath_t *dest, seL4_Word type,
+                                              seL4_Word size_bits, bool can_use_dev, seL4_Word *res)
+{
+    int error = memory_base_vka.utspace_alloc_maybe_device(data, dest, type, size_bits, can_use_dev, res);
+    memory_allocated(error, type, size_bits);
+    return error;
+}
+
+static int utspace_alloc_at_counted(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                    uintptr_t paddr, seL4_Word *cookie)
+{
+    int error = memory_base_vka.utspace_alloc_at(data, dest, type, size_bits, paddr, cookie);
+    memory_allocated(error, type, size_bits);
+    return error;
+}
+
+static void utspace_free_counted(void *data, seL4_Word type, seL4_Word size_bits, seL4_Word target)
+{
+    memory_base_vka.utspace_free(data, type, size_bits, target);
+    test_memory->bytes -= BIT(size_bits);
+}
+
+/* Highest slot handed out by the allocator in each second level CNode, or in
+ * the only CNode without CONFIG_TWO_LEVEL_CSPACE, so that a test process
+ * running stateless tests knows which slots to clean up after each test. 0 if
+ * the allocator hasn't handed out any slots there. */
+#define CSPACE_NODES (config_set(CONFIG_TWO_LEVEL_CSPACE) ? BIT(TEST_PROCESS_CSPACE_L1_BITS) : 1)
+static seL4_CPtr last_allocated_slot[BIT(TEST_PROCESS_CSPACE_L1_BITS)];
+static vka_cspace_alloc_fn cspace_alloc_base;
+
+static inline int cspace_node(seL4_CPtr slot)
+{
+    return config_set(CONFIG_TWO_LEVEL_CSPACE) ? slot >> TEST_PROCESS_CSPACE_L2_BITS : 0;
+}
+
+static int cspace_alloc_tracked(void *data, seL4_CPtr *res)
+{
+    int error;
+    /* Allocman takes the memory for a new second level CNode straight from
+     * its untypeds, without going through the vka, so give it more here. */
+    do {
+        error = cspace_alloc_base(data, res);
+    } while (error && add_untyped_batch(UNTYPED_BATCH_BYTES));
+    if (!error) {
+        int node = cspace_node(*res);
+        last_allocated_slot[node] = MAX(last_allocated_slot[node], *res);
+    }
+    return error;
+}
+
+/* Delete every cap the test put in a slot it got from the allocator. Anything
+ * else the allocator made came from the untypeds, which the driver revokes.
+ * This unmaps the allocator's own memory, so the allocator can't be used again
+ * until it is initialised from scratch. */
+static void clean_cspace(test_init_data_t *init_data)
+{
+    for (int node = 0; node < CSPACE_NODES; node++) {
+        /* the allocator never hands out slots of the untyped CNode, whose
+         * untypeds have to be kept for the next test */
+        if (last_allocated_slot[node] == 0 ||
+            (config_set(CONFIG_SHARED_UNTYPED_CNODE) && node == TEST_PROCESS_UNTYPED_CNODE_INDEX)) {
+            continue;
+        }
+        /* the driver's caps are at the start of the first CNode */
+        seL4_CPtr first = node == 0 ? init_data->free_slots.start : (seL4_CPtr) node << TEST_PROCESS_CSPACE_L2_BITS;
+        for (seL4_CPtr slot = first; slot <= last_allocated_slot[node]; slot++) {
+            seL4_CNode_Delete(init_data->root_cnode, slot, seL4_WordBits);
+        }
+        last_allocated_slot[node] = 0;
+    }
+}
+
 static void init_allocator(env_t env, test_init_data_t *init_data)
 {
     UNUSED int error;
     UNUSED reservation_t virtual_reservation;
 
     /* initialise allocator */
-    allocman_t *allocator = bootstrap_use_current_1level(init_data->root_cnode,
-                                                         init_data->cspace_size_bits, init_data->free_slots.start,
-                                                         init_data->free_slots.end, ALLOCATOR_STATIC_POOL_SIZE,
-                                                         allocator_mem_pool);
-    if (allocator == NULL) {
-        ZF_LOGF("Failed to bootstrap allocator");
+    allocman_t *allocator;
+    if (config_set(CONFIG_TWO_LEVEL_CSPACE)) {
+        allocator = bootstrap_create_allocman(ALLOCATOR_STATIC_POOL_SIZE, allocator_mem_pool);
+        if (allocator == NULL) {
+            ZF_LOGF("Failed to bootstrap allocator");
+        }
+        /* the driver filled the start of the first second level CNode, and the
+         * allocator creates more second level CNodes when it needs them */
+        error = cspace_two_level_create(allocator, (struct cspace_two_level_config) {
+            .cnode = init_data->root_cnode,
+            .cnode_size_bits = TEST_PROCESS_CSPACE_L1_BITS,
+            .cnode_guard_bits = seL4_WordBits - TEST_PROCESS_CSPACE_L1_BITS - TEST_PROCESS_CSPACE_L2_BITS,
+            .first_slot = config_set(CONFIG_SHARED_UNTYPED_CNODE) ? TEST_PROCESS_UNTYPED_CNODE_INDEX + 1 : 1,
+            .end_slot = BIT(TEST_PROCESS_CSPACE_L1_BITS),
+            .level_two_bits = TEST_PROCESS_CSPACE_L2_BITS,
+            .start_existing_index = 0,
+            .end_existing_index = 1,
+            .start_existing_slot = 0,
+            .end_existing_slot = init_data->free_slots.start,
+        }, &two_level_cspace);
+        if (error) {
+            ZF_LOGF("Failed to create two level cspace");
+        }
+        error = allocman_attach_cspace(allocator, cspace_two_level_make_interface(&two_level_cspace));
+        if (error) {
+            ZF_LOGF("Failed to attach cspace to allocator");
+        }
+    } else {
+        allocator = bootstrap_use_current_1level(init_data->root_cnode,
+                                                 init_data->cspace_size_bits, init_data->free_slots.start,
+                                                 init_data->free_slots.end, ALLOCATOR_STATIC_POOL_SIZE,
+                                                 allocator_mem_pool);
+        if (allocator == NULL) {
+            ZF_LOGF("Failed to bootstrap allocator");
+        }
     }
     allocman_make_vka(&env->vka, allocator);
+    cspace_alloc_base = env->vka.cspace_alloc;
+    env->vka.cspace_alloc = cspace_alloc_tracked;
 
     /* fill the allocator with untypeds */
-    seL4_CPtr slot;
-    unsigned int size_bits_index;
-    size_t size_bits;
-    cspacepath_t path;
-    for (slot = init_data->untypeds.start, size_bits_index = 0;
-         slot <= init_data->untypeds.end;
-         slot++, size_bits_index++) {
-
-        vka_cspace_make_path(&env->vka, slot, &path);
-        /* allocman doesn't require the paddr unless we need to ask for phys addresses,
-         * which we don't. */
-        size_bits = init_data->untyped_size_bits_list[size_bits_index];
-        error = allocman_utspace_add_uts(allocator, 1, &path, &size_bits, NULL,
-                                         ALLOCMAN_UT_KERNEL);
-        if (error) {
-            ZF_LOGF("Failed to add untyped objects to allocator");
+    untyped_init_data = init_data;
+    untyped_vka = &env->vka;
+    if (config_set(CONFIG_REVOKE_USED_UNTYPEDS) || config_set(CONFIG_LAZY_TEST_ALLOCATOR)) {
+        /* Start with one batch, or nothing if lazy, and add more whenever an
+         * allocation fails. Allocations at a paddr are left alone, as the
+         * untypeds are added without their paddrs and could never serve them. */
+        if (!config_set(CONFIG_LAZY_TEST_ALLOCATOR)) {
+            add_untyped_batch(UNTYPED_BATCH_BYTES);
         }
+        untyped_base_vka = env->vka;
+        env->vka.utspace_alloc = utspace_alloc_batched;
+        env->vka.utspace_alloc_maybe_device = utspace_alloc_maybe_device_batched;
+    } else {
+        add_untyped_batch(SIZE_MAX);
+    }
+
+    /* count everything from here on, including the test's own vspace */
+    if (config_set(CONFIG_MEMORY_ACCOUNTING)) {
+        test_memory = &init_data->memory;
+        memset(test_memory, 0, sizeof(*test_memory));
+        memory_base_vka = env->vka;
+        env->vka.utspace_alloc = utspace_alloc_counted;
+        env->vka.utspace_alloc_maybe_device = utspace_alloc_maybe_device_counted;
+        env->vka.utspace_alloc_at = utspace_alloc_at_counted;
+        env->vka.utspace_free = utspace_free_counted;
     }
 
     /* add any arch specific objects to the allocator */
@@ -186,6 +448,7 @@ int main(int argc, char **argv)
 
     /* read in init data */
     init_data = (void *) atol(argv[1]);
+    shared_log = init_data->log_ring;
 
     /* configure env */
     env.cspace_root = init_data->root_cnode;
@@ -212,38 +475,59 @@ int main(int argc, char **argv)
     memcpy(env.regions, init_data->elf_regions, sizeof(sel4utils_elf_region_t) * env.num_regions);
 
     env.timer_notification.cptr = init_data->timer_ntfn;
+    init_timer_clients(init_data->timer_client_ntfns);
+    init_clock_page(init_data->clock_page);
 
     env.device_frame = init_data->device_frame_cap;
 
-    /* initialse cspace, vspace and untyped memory allocation */
-    init_allocator(&env, init_data);
-
-    /* initialise simple */
-    init_simple(&env, init_data);
-
-    /* initialise rpc client */
-    sel4rpc_client_init(&env.rpc_client, env.endpoint, SEL4TEST_PROTOBUF_RPC);
+    while (1) {
+        /* initialse cspace, vspace and untyped memory allocation */
+        init_allocator(&env, init_data);
+        int error = sync_mutex_new(&env.vka, &output_lock);
+        ZF_LOGF_IF(error, "Failed to create output lock");
+        output_lock_ready = true;
+
+        /* initialise simple */
+        init_simple(&env, init_data);
+
+        /* initialise rpc client */
+        sel4rpc_client_init(&env.rpc_client, env.endpoint, SEL4TEST_PROTOBUF_RPC);
+
+        /* find the test */
+        testcase_t *test = find_test(init_data->name);
+
+        /* run the test */
+        sel4test_reset();
+        test_result_t result = SUCCESS;
+        if (test) {
+            printf("Running test %s (%s)\n", test->name, test->description);
+            result = test->function((uintptr_t)&env);
+        } else {
+            result = FAILURE;
+            ZF_LOGF("Cannot find test %s\n", init_data->name);
+        }
 
-    /* find the test */
-    testcase_t *test = find_test(init_data->name);
+        printf("Test %s %s\n", init_data->name, result == SUCCESS ? "passed" : "failed");
+        quiet_log_flush(result != SUCCESS);
+
+        if (test && test->test_type == STATELESS) {
+            /* clean up and wait for the driver to give us another test */
+            output_lock_ready = false;
+            clean_cspace(init_data);
+            seL4_MessageInfo_t info = seL4_MessageInfo_new(seL4_Fault_NullFault, 0, 0, 2);
+            seL4_SetMR(0, result);
+            seL4_SetMR(1, TEST_PROCESS_WAITING);
+            seL4_Call(endpoint, info);
+            continue;
+        }
 
-    /* run the test */
-    sel4test_reset();
-    test_result_t result = SUCCESS;
-    if (test) {
-        printf("Running test %s (%s)\n", test->name, test->description);
-        result = test->function((uintptr_t)&env);
-    } else {
-        result = FAILURE;
-        ZF_LOGF("Cannot find test %s\n", init_data->name);
+        /* send our result back */
+        seL4_MessageInfo_t info = seL4_MessageInfo_new(seL4_Fault_NullFault, 0, 0, 1);
+        seL4_SetMR(0, result);
+        seL4_Send(endpoint, info);
+        break;
     }
 
-    printf("Test %s %s\n", init_data->name, result == SUCCESS ? "passed" : "failed");
-    /* send our result back */
-    seL4_MessageInfo_t info = seL4_MessageInfo_new(seL4_Fault_NullFault, 0, 0, 1);
-    seL4_SetMR(0, result);
-    seL4_Send(endpoint, info);
-
     /* It is expected that we are torn down by the test driver before we are
      * scheduled to run again after signalling them with the above send.
      */
@@ -22,3 +22,16 @@
 
 void arch_init_simple(env_t env, simple_t *simple);
 
+
+/* Define a test that calls _function with the test's env followed by the given
+ * arguments, which may use env. This splits a test that loops over a matrix of
+ * parameters into a test case for each point of the matrix, so that each point
+ * can be selected, timed, sharded and retried on its own. _name should be the
+ * name of the whole test with a suffix for the parameters, so it stays the same
+ * from one build to the next. */
+#define DEFINE_TEST_PARAM(_name, _description, _function, _enabled, ...) \
+    static int TEST_PARAM_ ## _name(env_t env) \
+    { \
+        return _function(env, __VA_ARGS__); \
+    } \
+    DEFINE_TEST(_name, _description, TEST_PARAM_ ## _name, _enabled)
@@ -261,6 +261,7 @@ static int test_device_frame_ipcbuf(env_t env)
 }
 DEFINE_TEST(FRAMEDIPC0001, "Test that we cannot create a thread with an IPC buffer that is a frame",
             test_device_frame_ipcbuf, !config_set(CONFIG_PLAT_SPIKE))
+DEFINE_TEST_METADATA(FRAMEDIPC0001, .needs_device_frame = true)
 
 static int wait_func(seL4_Word ep)
 {
@@ -300,6 +301,7 @@ static int test_switch_device_frame_ipcbuf(env_t env)
 }
 DEFINE_TEST(FRAMEDIPC0002, "Test that we cannot switch a threads IPC buffer to a device frame",
             test_switch_device_frame_ipcbuf, !config_set(CONFIG_PLAT_SPIKE))
+DEFINE_TEST_METADATA(FRAMEDIPC0002, .needs_device_frame = true)
 
 static int touch_data_fault(seL4_Word data, seL4_Word fault_ep, seL4_Word arg3, seL4_Word arg4)
 {
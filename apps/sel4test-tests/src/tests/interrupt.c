@@ -255,3 +255,61 @@ static int test_interrupt_delete_sc(env_t env)
 }
 DEFINE_TEST(INTERRUPT0006, "Test interrupts after deleting scheduling context bound to notification",
             test_interrupt_delete_sc, config_set(CONFIG_HAVE_TIMER) &&config_set(CONFIG_KERNEL_MCS));
+
+/* order in which the threads sleeping on different timer clients woke up */
+struct timer_client_wakeups {
+    seL4_Word count;
+    volatile seL4_Word helper;
+    volatile seL4_Word test;
+};
+
+static int timer_client_sleeper(env_t env, seL4_Word client, seL4_Word ns, struct timer_client_wakeups *wakeups)
+{
+    sel4test_sleep_client(env, client, ns);
+    wakeups->helper = __atomic_add_fetch(&wakeups->count, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* test that threads using different timer clients can sleep at the same time */
+static int test_timer_clients(env_t env)
+{
+    helper_thread_t helper;
+    struct timer_client_wakeups wakeups = {0};
+
+    /* the helper sleeps on client 1 for less time than the test sleeps on
+     * client 0, while client 2 ticks periodically */
+    create_helper_thread(env, &helper);
+    start_helper(env, &helper, (helper_fn_t) timer_client_sleeper, (seL4_Word) env, 1, 10 * NS_IN_MS,
+                 (seL4_Word) &wakeups);
+    sel4test_periodic_start_client(env, 2, 5 * NS_IN_MS);
+    sel4test_sleep(env, 30 * NS_IN_MS);
+    wakeups.test = __atomic_add_fetch(&wakeups.count, 1, __ATOMIC_RELAXED);
+
+    wait_for_helper(&helper);
+    test_eq(wakeups.helper, (seL4_Word) 1);
+    test_eq(wakeups.test, (seL4_Word) 2);
+
+    /* the periodic client kept its own timeout, and its badge says which client it is */
+    test_eq(sel4test_ntfn_timer_wait_client(env, 2), (seL4_Word) TIMER_CLIENT_BADGE(2));
+
+    cleanup_helper(env, &helper);
+    sel4test_timer_reset(env);
+    return sel4test_get_result();
+}
+DEFINE_TEST(INTERRUPT0007, "Test threads using different timer clients sleep independently", test_timer_clients,
+            config_set(CONFIG_HAVE_TIMER));
+
+/* test that timestamps, which may come from the clock page, keep up with the driver's timer */
+static int test_timestamp_sleep(env_t env)
+{
+    for (int i = 0; i < 3; i++) {
+        uint64_t start = sel4test_timestamp(env);
+        sel4test_sleep(env, 10 * NS_IN_MS);
+        uint64_t end = sel4test_timestamp(env);
+        test_geq(end - start, (uint64_t) 10 * NS_IN_MS);
+        test_lt(end - start, (uint64_t) NS_IN_S);
+    }
+    return sel4test_get_result();
+}
+DEFINE_TEST(INTERRUPT0008, "Test timestamps agree with the time slept", test_timestamp_sleep,
+            config_set(CONFIG_HAVE_TIMER));
@@ -272,7 +272,8 @@ static int nbsendrecv_func(seL4_Word endpoint, seL4_Word seed, seL4_Word reply,
 }
 #endif /* CONFIG_KERNEL_MCS */
 
-static int test_ipc_pair(env_t env, test_func_t fa, test_func_t fb, bool inter_as, seL4_Word nr_cores)
+static int test_ipc_pair(env_t env, test_func_t fa, test_func_t fb, bool inter_as, seL4_Word nr_cores,
+                         int sender_prio, bool sender_first)
 {
     helper_thread_t thread_a, thread_b;
     vka_t *vka = &env->vka;
@@ -280,85 +281,79 @@ static int test_ipc_pair(env_t env, test_func_t fa, test_func_t fb, bool inter_a
     UNUSED int error;
     seL4_CPtr ep = vka_alloc_endpoint_leaky(vka);
     seL4_Word start_number = 0xabbacafe;
+    int waiter_prio = 100;
 
     seL4_CPtr a_reply = vka_alloc_reply_leaky(vka);
     seL4_CPtr b_reply = vka_alloc_reply_leaky(vka);
 
     /* Test sending messages of varying lengths. */
-    /* Please excuse the awful indending here. */
     for (int core_a = 0; core_a < nr_cores; core_a++) {
         for (int core_b = 0; core_b < nr_cores; core_b++) {
-            for (int sender_prio = 98; sender_prio <= 102; sender_prio++) {
-                for (int waiter_prio = 100; waiter_prio <= 100; waiter_prio++) {
-                    for (int sender_first = 0; sender_first <= 1; sender_first++) {
-                        ZF_LOGD("%d %s %d\n",
-                                sender_prio, sender_first ? "->" : "<-", waiter_prio);
-                        seL4_Word thread_a_arg0, thread_b_arg0;
-                        seL4_CPtr thread_a_reply, thread_b_reply;
-
-                        if (inter_as) {
-                            create_helper_process(env, &thread_a);
-
-                            cspacepath_t path;
-                            vka_cspace_make_path(&env->vka, ep, &path);
-                            thread_a_arg0 = sel4utils_copy_path_to_process(&thread_a.process, path);
-                            assert(thread_a_arg0 != -1);
-
-                            create_helper_process(env, &thread_b);
-                            thread_b_arg0 = sel4utils_copy_path_to_process(&thread_b.process, path);
-                            assert(thread_b_arg0 != -1);
-
-                            if (config_set(CONFIG_KERNEL_MCS)) {
-                                thread_a_reply = sel4utils_copy_cap_to_process(&thread_a.process, vka, a_reply);
-                                thread_b_reply = sel4utils_copy_cap_to_process(&thread_b.process, vka, b_reply);
-                            }
-                        } else {
-                            create_helper_thread(env, &thread_a);
-                            create_helper_thread(env, &thread_b);
-                            thread_a_arg0 = ep;
-                            thread_b_arg0 = ep;
-                            thread_a_reply = a_reply;
-                            thread_b_reply = b_reply;
-                        }
-
-                        set_helper_priority(env, &thread_a, sender_prio);
-                        set_helper_priority(env, &thread_b, waiter_prio);
-
-                        set_helper_affinity(env, &thread_a, core_a);
-                        set_helper_affinity(env, &thread_b, core_b);
-
-                        /* Set the flag for nbwait_func that tells it whether or not it really
-                         * should wait. */
-                        int nbwait_should_wait;
-                        nbwait_should_wait =
-                            (sender_prio < waiter_prio);
-
-                        /* Threads are enqueued at the head of the scheduling queue, so the
-                         * thread enqueued last will be run first, for a given priority. */
-                        if (sender_first) {
-                            start_helper(env, &thread_b, (helper_fn_t) fb, thread_b_arg0, start_number,
-                                         thread_b_reply, nbwait_should_wait);
-                            start_helper(env, &thread_a, (helper_fn_t) fa, thread_a_arg0, start_number,
-                                         thread_a_reply, nbwait_should_wait);
-                        } else {
-                            start_helper(env, &thread_a, (helper_fn_t) fa, thread_a_arg0, start_number,
-                                         thread_a_reply, nbwait_should_wait);
-                            start_helper(env, &thread_b, (helper_fn_t) fb, thread_b_arg0, start_number,
-                                         thread_b_reply, nbwait_should_wait);
-                        }
-
-                        test_result_t res = wait_for_helper(&thread_a);
-                        test_eq(res, SUCCESS);
-                        res = wait_for_helper(&thread_b);
-                        test_eq(res, SUCCESS);
-
-                        cleanup_helper(env, &thread_a);
-                        cleanup_helper(env, &thread_b);
-
-                        start_number += 0x71717171;
-                    }
+            ZF_LOGD("%d %s %d\n",
+                    sender_prio, sender_first ? "->" : "<-", waiter_prio);
+            seL4_Word thread_a_arg0, thread_b_arg0;
+            seL4_CPtr thread_a_reply, thread_b_reply;
+
+            if (inter_as) {
+                create_helper_process(env, &thread_a);
+
+                cspacepath_t path;
+                vka_cspace_make_path(&env->vka, ep, &path);
+                thread_a_arg0 = sel4utils_copy_path_to_process(&thread_a.process, path);
+                assert(thread_a_arg0 != -1);
+
+                create_helper_process(env, &thread_b);
+                thread_b_arg0 = sel4utils_copy_path_to_process(&thread_b.process, path);
+                assert(thread_b_arg0 != -1);
+
+                if (config_set(CONFIG_KERNEL_MCS)) {
+                    thread_a_reply = sel4utils_copy_cap_to_process(&thread_a.process, vka, a_reply);
+                    thread_b_reply = sel4utils_copy_cap_to_process(&thread_b.process, vka, b_reply);
                 }
+            } else {
+                create_helper_thread(env, &thread_a);
+                create_helper_thread(env, &thread_b);
+                thread_a_arg0 = ep;
+                thread_b_arg0 = ep;
+                thread_a_reply = a_reply;
+                thread_b_reply = b_reply;
             }
+
+            set_helper_priority(env, &thread_a, sender_prio);
+            set_helper_priority(env, &thread_b, waiter_prio);
+
+            set_helper_affinity(env, &thread_a, core_a);
+            set_helper_affinity(env, &thread_b, core_b);
+
+            /* Set the flag for nbwait_func that tells it whether or not it really
+             * should wait. */
+            int nbwait_should_wait;
+            nbwait_should_wait =
+                (sender_prio < waiter_prio);
+
+            /* Threads are enqueued at the head of the scheduling queue, so the
+             * thread enqueued last will be run first, for a given priority. */
+            if (sender_first) {
+                start_helper(env, &thread_b, (helper_fn_t) fb, thread_b_arg0, start_number,
+                             thread_b_reply, nbwait_should_wait);
+                start_helper(env, &thread_a, (helper_fn_t) fa, thread_a_arg0, start_number,
+                             thread_a_reply, nbwait_should_wait);
+            } else {
+                start_helper(env, &thread_a, (helper_fn_t) fa, thread_a_arg0, start_number,
+                             thread_a_reply, nbwait_should_wait);
+                start_helper(env, &thread_b, (helper_fn_t) fb, thread_b_arg0, start_number,
+                             thread_b_reply, nbwait_should_wait);
+            }
+
+            test_result_t res = wait_for_helper(&thread_a);
+            test_eq(res, SUCCESS);
+            res = wait_for_helper(&thread_b);
+            test_eq(res, SUCCESS);
+
+            cleanup_helper(env, &thread_a);
+            cleanup_helper(env, &thread_b);
+
+            start_number += 0x71717171;
         }
     }
 
@@ -367,60 +362,47 @@ static int test_ipc_pair(env_t env, test_func_t fa, test_func_t fb, bool inter_a
     return sel4test_get_result();
 }
 
-static int test_send_wait(env_t env)
-{
-    return test_ipc_pair(env, send_func, wait_func, false, env->cores);
-}
-DEFINE_TEST(IPC0001, "Test SMP seL4_Send + seL4_Recv", test_send_wait, true)
-
-static int
-test_call_replywait(env_t env)
-{
-    return test_ipc_pair(env, call_func, replywait_func, false, env->cores);
-}
-DEFINE_TEST(IPC0002, "Test SMP seL4_Call + seL4_ReplyRecv", test_call_replywait, true)
-
-static int
-test_call_reply_and_wait(env_t env)
-{
-    return test_ipc_pair(env, call_func, reply_and_wait_func, false, env->cores);
-}
-DEFINE_TEST(IPC0003, "Test SMP seL4_Send + seL4_Reply + seL4_Recv", test_call_reply_and_wait, true)
-
-static int
-test_nbsend_wait(env_t env)
-{
-    return test_ipc_pair(env, nbsend_func, nbwait_func, false, 1);
-}
-DEFINE_TEST(IPC0004, "Test seL4_NBSend + seL4_Recv", test_nbsend_wait, true)
-
-static int
-test_send_wait_interas(env_t env)
-{
-    return test_ipc_pair(env, send_func, wait_func, true, env->cores);
-}
-DEFINE_TEST(IPC1001, "Test SMP inter-AS seL4_Send + seL4_Recv", test_send_wait_interas, true)
-
-static int
-test_call_replywait_interas(env_t env)
-{
-    return test_ipc_pair(env, call_func, replywait_func, true, env->cores);
-}
-DEFINE_TEST(IPC1002, "Test SMP inter-AS seL4_Call + seL4_ReplyRecv", test_call_replywait_interas, true)
-
-static int
-test_call_reply_and_wait_interas(env_t env)
-{
-    return test_ipc_pair(env, call_func, reply_and_wait_func, true, env->cores);
-}
-DEFINE_TEST(IPC1003, "Test SMP inter-AS seL4_Send + seL4_Reply + seL4_Recv", test_call_reply_and_wait_interas, true)
-
-static int
-test_nbsend_wait_interas(env_t env)
-{
-    return test_ipc_pair(env, nbsend_func, nbwait_func, true, 1);
-}
-DEFINE_TEST(IPC1004, "Test inter-AS seL4_NBSend + seL4_Recv", test_nbsend_wait_interas, true)
+/* Define a test case for each sender priority, from 98 to 102, and each order of
+ * starting the sender and waiter, which runs at priority 100. The arguments after
+ * _enabled are passed to test_ipc_pair before the sender priority and order. */
+#define DEFINE_IPC_PAIR_TEST(_name, _description, _enabled, ...) \
+    DEFINE_TEST_PARAM(_name ## _P98_SENDER_FIRST, _description " (sender prio 98, sender first)", \
+                      test_ipc_pair, _enabled, __VA_ARGS__, 98, true) \
+    DEFINE_TEST_PARAM(_name ## _P98_WAITER_FIRST, _description " (sender prio 98, waiter first)", \
+                      test_ipc_pair, _enabled, __VA_ARGS__, 98, false) \
+    DEFINE_TEST_PARAM(_name ## _P99_SENDER_FIRST, _description " (sender prio 99, sender first)", \
+                      test_ipc_pair, _enabled, __VA_ARGS__, 99, true) \
+    DEFINE_TEST_PARAM(_name ## _P99_WAITER_FIRST, _description " (sender prio 99, waiter first)", \
+                      test_ipc_pair, _enabled, __VA_ARGS__, 99, false) \
+    DEFINE_TEST_PARAM(_name ## _P100_SENDER_FIRST, _description " (sender prio 100, sender first)", \
+                      test_ipc_pair, _enabled, __VA_ARGS__, 100, true) \
+    DEFINE_TEST_PARAM(_name ## _P100_WAITER_FIRST, _description " (sender prio 100, waiter first)", \
+                      test_ipc_pair, _enabled, __VA_ARGS__, 100, false) \
+    DEFINE_TEST_PARAM(_name ## _P101_SENDER_FIRST, _description " (sender prio 101, sender first)", \
+                      test_ipc_pair, _enabled, __VA_ARGS__, 101, true) \
+    DEFINE_TEST_PARAM(_name ## _P101_WAITER_FIRST, _description " (sender prio 101, waiter first)", \
+                      test_ipc_pair, _enabled, __VA_ARGS__, 101, false) \
+    DEFINE_TEST_PARAM(_name ## _P102_SENDER_FIRST, _description " (sender prio 102, sender first)", \
+                      test_ipc_pair, _enabled, __VA_ARGS__, 102, true) \
+    DEFINE_TEST_PARAM(_name ## _P102_WAITER_FIRST, _description " (sender prio 102, waiter first)", \
+                      test_ipc_pair, _enabled, __VA_ARGS__, 102, false)
+
+DEFINE_IPC_PAIR_TEST(IPC0001, "Test SMP seL4_Send + seL4_Recv", true,
+                     send_func, wait_func, false, env->cores)
+DEFINE_IPC_PAIR_TEST(IPC0002, "Test SMP seL4_Call + seL4_ReplyRecv", true,
+                     call_func, replywait_func, false, env->cores)
+DEFINE_IPC_PAIR_TEST(IPC0003, "Test SMP seL4_Send + seL4_Reply + seL4_Recv", true,
+                     call_func, reply_and_wait_func, false, env->cores)
+DEFINE_IPC_PAIR_TEST(IPC0004, "Test seL4_NBSend + seL4_Recv", true,
+                     nbsend_func, nbwait_func, false, 1)
+DEFINE_IPC_PAIR_TEST(IPC1001, "Test SMP inter-AS seL4_Send + seL4_Recv", true,
+                     send_func, wait_func, true, env->cores)
+DEFINE_IPC_PAIR_TEST(IPC1002, "Test SMP inter-AS seL4_Call + seL4_ReplyRecv", true,
+                     call_func, replywait_func, true, env->cores)
+DEFINE_IPC_PAIR_TEST(IPC1003, "Test SMP inter-AS seL4_Send + seL4_Reply + seL4_Recv", true,
+                     call_func, reply_and_wait_func, true, env->cores)
+DEFINE_IPC_PAIR_TEST(IPC1004, "Test inter-AS seL4_NBSend + seL4_Recv", true,
+                     nbsend_func, nbwait_func, true, 1)
 
 static int
 test_ipc_abort_in_call(env_t env)
@@ -1234,18 +1216,10 @@ static int test_delete_reply_cap_then_sc(env_t env)
 DEFINE_TEST(IPC0024, "Test deleting the reply cap in the scheduling context",
             test_delete_reply_cap_then_sc, config_set(CONFIG_KERNEL_MCS));
 
-static int test_nbsendrecv(env_t env)
-{
-    return test_ipc_pair(env, (test_func_t) nbsendrecv_func, (test_func_t) nbsendrecv_func, false, env->cores);
-}
-DEFINE_TEST(IPC0025, "Test seL4_nbsendrecv + seL4_nbsendrecv", test_nbsendrecv, config_set(CONFIG_KERNEL_MCS))
-
-static int test_nbsendrecv_interas(env_t env)
-{
-    return test_ipc_pair(env, (test_func_t) nbsendrecv_func, (test_func_t) nbsendrecv_func, false, env->cores);
-}
-DEFINE_TEST(IPC0026, "Test interas seL4_nbsendrecv + seL4_nbsendrecv", test_nbsendrecv_interas,
-            config_set(CONFIG_KERNEL_MCS))
+DEFINE_IPC_PAIR_TEST(IPC0025, "Test seL4_nbsendrecv + seL4_nbsendrecv", config_set(CONFIG_KERNEL_MCS),
+                     (test_func_t) nbsendrecv_func, (test_func_t) nbsendrecv_func, false, env->cores)
+DEFINE_IPC_PAIR_TEST(IPC0026, "Test interas seL4_nbsendrecv + seL4_nbsendrecv", config_set(CONFIG_KERNEL_MCS),
+                     (test_func_t) nbsendrecv_func, (test_func_t) nbsendrecv_func, false, env->cores)
 
 static int
 test_sched_donation_low_prio_server(env_t env)
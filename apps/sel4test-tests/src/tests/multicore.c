@@ -81,6 +81,7 @@ int smp_test_tcb_resume(env_t env)
 }
 DEFINE_TEST(MULTICORE0001, "Test suspending and resuming a thread on different core", smp_test_tcb_resume,
             config_set(CONFIG_HAVE_TIMER) &&CONFIG_MAX_NUM_NODES > 1)
+DEFINE_TEST_METADATA(MULTICORE0001, .cores = CONFIG_MAX_NUM_NODES, .needs_timer = true, .tags = "smp")
 
 int smp_test_tcb_move(env_t env)
 {
@@ -121,6 +122,7 @@ int smp_test_tcb_move(env_t env)
 }
 DEFINE_TEST(MULTICORE0002, "Test thread is runnable on all available cores (0 + other)", smp_test_tcb_move,
             config_set(CONFIG_HAVE_TIMER) &&CONFIG_MAX_NUM_NODES > 1)
+DEFINE_TEST_METADATA(MULTICORE0002, .cores = CONFIG_MAX_NUM_NODES, .needs_timer = true, .tags = "smp")
 
 int smp_test_tcb_delete(env_t env)
 {
@@ -169,6 +171,7 @@ int smp_test_tcb_delete(env_t env)
 
 DEFINE_TEST(MULTICORE0005, "Test remote delete thread running on other cores", smp_test_tcb_delete,
             config_set(CONFIG_HAVE_TIMER) &&CONFIG_MAX_NUM_NODES > 1)
+DEFINE_TEST_METADATA(MULTICORE0005, .cores = CONFIG_MAX_NUM_NODES, .needs_timer = true, .tags = "smp")
 
 static int
 faulter_func(volatile seL4_Word shared_mem)
@@ -286,6 +289,7 @@ int smp_test_tlb(env_t env)
 }
 DEFINE_TEST(MULTICORE0003, "Test TLB invalidated cross cores", smp_test_tlb,
             config_set(CONFIG_HAVE_TIMER) &&CONFIG_MAX_NUM_NODES > 1)
+DEFINE_TEST_METADATA(MULTICORE0003, .cores = CONFIG_MAX_NUM_NODES, .needs_timer = true, .tags = "smp")
 
 static int
 kernel_entry_func(seL4_Word *unused)
@@ -337,3 +341,4 @@ int smp_test_tcb_clh(env_t env)
 }
 DEFINE_TEST(MULTICORE0004, "Test core stalling is behaving properly (flaky)", smp_test_tcb_clh,
             CONFIG_MAX_NUM_NODES > 1)
+DEFINE_TEST_METADATA(MULTICORE0004, .cores = CONFIG_MAX_NUM_NODES, .tags = "smp")
@@ -15,7 +15,8 @@ int test_trivial(env_t env)
     test_geq(2, 1);
     return sel4test_get_result();
 }
-DEFINE_TEST(TRIVIAL0000, "Ensure the test framework functions", test_trivial, true)
+DEFINE_TEST_STATELESS(TRIVIAL0000, "Ensure the test framework functions", test_trivial, true)
+DEFINE_TEST_METADATA(TRIVIAL0000, .tags = "smoke")
 
 int test_allocator(env_t env)
 {
@@ -32,5 +33,7 @@ int test_allocator(env_t env)
 
     return sel4test_get_result();
 }
-DEFINE_TEST(TRIVIAL0001, "Ensure the allocator works", test_allocator, true)
-DEFINE_TEST(TRIVIAL0002, "Ensure the allocator works more than once", test_allocator, true)
+DEFINE_TEST_STATELESS(TRIVIAL0001, "Ensure the allocator works", test_allocator, true)
+DEFINE_TEST_METADATA(TRIVIAL0001, .tags = "smoke")
+DEFINE_TEST_STATELESS(TRIVIAL0002, "Ensure the allocator works more than once", test_allocator, true)
+DEFINE_TEST_METADATA(TRIVIAL0002, .tags = "smoke")